@@ -0,0 +1,184 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "frame.hpp"
+#include "governor.hpp"
+#include "cache.hpp"
+#include "diskcache.hpp"
+#include "dir.hpp"
+#include "filelist.hpp"
+#include "prefetch.hpp"
+#include "bench.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static const uint64_t seed = 0x1b0a5eedULL;	//!< Seed of the synthetic images
+
+/******************************************************************************
+ * \brief Make a synthetic image
+ *
+ * The image is smooth structure with fine noise on top, so that it compresses
+ * about as well as a photograph rather than as well as a flat image or as
+ * badly as pure noise.  The same size and number always give the same image.
+ *
+ * @param [in] cols number of columns
+ * @param [in] rows number of rows
+ * @param [in] n number of the image, to make each image different
+ * \return the image
+ *****************************************************************************/
+
+static cv::Mat synth_image(int cols, int rows, int n)
+{
+	cv::RNG rng(seed + static_cast<uint64_t>(n));	//!< Generator for this image
+
+	cv::Mat coarse(8, 8, CV_8UC3);		//!< Structure of the image
+	rng.fill(coarse, cv::RNG::UNIFORM, 0, 256);
+	cv::Mat img;						//!< Image to be returned
+	cv::resize(coarse, img, cv::Size(cols, rows), 0, 0, cv::INTER_CUBIC);
+
+	cv::Mat noise(rows, cols, CV_8UC3);	//!< Detail of the image
+	rng.fill(noise, cv::RNG::UNIFORM, 0, 24);
+	cv::add(img, noise, img);
+
+	return (img);
+}
+
+/******************************************************************************
+ * \brief Write a synthetic corpus of images to benchmark with
+ *
+ * The spec is a comma-separated list of FORMAT:COLSxROWS items, such as
+ * jpg:6000x4000,png:1920x1080, where FORMAT is any file extension OpenCV can
+ * write.  For each item, count images are written to the directory, which is
+ * created if needed.  Images already there from an earlier run are left as
+ * they are, since they would be written the same.  Throws an exception if the
+ * spec is invalid or an image cannot be written.
+ *
+ * @param [in] dir directory to write the images to
+ * @param [in] spec formats and sizes of the images
+ * @param [in] count number of images of each format and size
+ *****************************************************************************/
+
+void make_corpus(const std::string& dir, const std::string& spec, int count)
+{
+	make_dirs(dir);
+
+	std::istringstream items(spec);		//!< Items of the spec
+	std::string item;					//!< Item being written
+	while (std::getline(items, item, ','))
+	{
+		char format[16];				//!< File extension
+		int cols, rows;					//!< Size of the images
+		char x;
+		if (sscanf(item.c_str(), "%15[^:]:%d%c%d", format, &cols, &x, &rows) != 4 || x != 'x' ||
+			cols <= 0 || rows <= 0)
+			throw (std::string("Invalid synthetic image spec ") + item);
+
+		for (int n = 0; n < count; n++)
+		{
+			std::ostringstream name;	//!< Name of the image file
+			name << dir << "/synth_" << cols << "x" << rows << "_" << std::setw(4)
+				 << std::setfill('0') << n << "." << format;
+
+			struct stat buf;
+			if (stat(name.str().c_str(), &buf) == 0)
+				continue;
+			if (!cv::imwrite(name.str(), synth_image(cols, rows, n)))
+				throw (std::string("Cannot write ") + name.str());
+		}
+	}
+}
+
+/******************************************************************************
+ * \brief Find the peak resident set size of the process
+ *
+ * \return peak resident set size in bytes
+ *****************************************************************************/
+
+static size_t peak_rss()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return (0);
+	return (pmc.PeakWorkingSetSize);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return (0);
+#ifdef __APPLE__
+	return (static_cast<size_t>(usage.ru_maxrss));			// bytes on Apple
+#else
+	return (static_cast<size_t>(usage.ru_maxrss) * 1024);	// kilobytes on Linux
+#endif
+#endif
+}
+
+/******************************************************************************
+ * \brief Run every file through the pipeline without showing it
+ *
+ * Step through the list as fast as the pipeline allows, moving the prefetch
+ * window along and taking each frame from the prefetcher as the event loop
+ * would, and report the number of images and their size in bytes per second
+ * from the start of the scan, and the peak resident set size.  Files that do
+ * not contain an image are dropped and do not count.  Throws an exception if
+ * the scan fails.
+ *
+ * @param [in] files list of files being filled by the scan
+ * @param [in] prefetch prefetcher to decode the files with
+ * @param [in] start time the scan was started
+ *****************************************************************************/
+
+void run_bench(FileList& files, Prefetcher& prefetch, std::chrono::steady_clock::time_point start)
+{
+	size_t images = 0;					//!< Number of images decoded
+	double bytes = 0;					//!< Size of the files of those images
+
+	for (size_t i = 0; files.wait(i); i++)
+	{
+		if (files.dropped(i))
+			continue;
+
+		prefetch.position(files, i);
+		Frame frame = prefetch.get(files[i]);
+		if (frame.image.empty())
+		{
+			files.drop(i);
+			continue;
+		}
+
+		images++;
+		struct stat buf;
+		if (stat(files[i].c_str(), &buf) == 0)
+			bytes += static_cast<double>(buf.st_size);
+	}
+
+	if (!files.error().empty())
+		throw (files.error());
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double mb = bytes / (1 << 20);		//!< Size of the files in MB
+
+	std::cout << std::fixed << std::setprecision(2)
+			  << "images      " << images << "\n"
+			  << "MB          " << mb << "\n"
+			  << "seconds     " << seconds << "\n"
+			  << "images/s    " << (seconds > 0 ? images / seconds : 0) << "\n"
+			  << "MB/s        " << (seconds > 0 ? mb / seconds : 0) << "\n"
+			  << "peak RSS MB " << static_cast<double>(peak_rss()) / (1 << 20) << std::endl;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+void make_corpus(const std::string& dir, const std::string& spec, int count);
+void run_bench(FileList& files, Prefetcher& prefetch, std::chrono::steady_clock::time_point start);
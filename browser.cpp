@@ -9,8 +9,17 @@
  * @param directory The directory that contains all the images to be displayed.
  *****************************************************************************/
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
+#include <functional>
 #include <iomanip>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 #include <assert.h>
 #include <opencv2/core.hpp>
@@ -18,6 +27,25 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/core/utility.hpp>
 #include "dir.hpp"
+#include "filelist.hpp"
+#include "sort.hpp"
+#include "frame.hpp"
+#include "header.hpp"
+#include "mapfile.hpp"
+#include "scale.hpp"
+#include "governor.hpp"
+#include "cache.hpp"
+#include "diskcache.hpp"
+#include "pool.hpp"
+#include "prefetch.hpp"
+#include "grid.hpp"
+#include "keycode.hpp"
+#include "zoom.hpp"
+#include "watch.hpp"
+#include "hash.hpp"
+#include "stats.hpp"
+#include "bench.hpp"
+#include "export.hpp"
 #include "browser.hpp"
 #ifdef _WIN32
 #include <Windows.h>
@@ -28,62 +56,25 @@ int maxrows;	//!< Default max number of rows to show
 
 
 /******************************************************************************
- * \brief Display the specified image.
+ * \brief Display the specified frame.
  *
- * Display the image specified in the argument.  This function ensures that the
- * image will fit in the windows, while maintaining the aspect ratio.
+ * Display the frame specified in the argument.  The frame has already been
+ * scaled to fit the window, while maintaining the aspect ratio.  The frame
+ * stays on screen until another one is displayed; the keys pressed by the
+ * user are read by the event loop.
  *
- * @param [in] Image to be displayed
- * \return Key pressed by the user
+ * @param [in] path Name of the file the frame was decoded from
+ * @param [in] frame Frame to be displayed
  *****************************************************************************/
 
-uchar display(const cv::Mat& img)
+void display(const std::string& path, const Frame& frame)
 {
-	float ratio = 1.0;			//!< Downsampling ratio
-
-	// Find out the dominant dimension from rows and columns.  This needs to be
-	// determined to find out whether the image is to be scaled by rows or
-	// Columns.
-
-	float ratio1 = static_cast<float>(maxcols) / img.cols;
-	float ratio2 = static_cast<float>(maxrows) / img.rows;
-	ratio = ratio1 < ratio2 ? ratio1 : ratio2;
-
-	// Prepare the affine transform.  OpenCV allows you to specify the affine
-	// transform by two triangles.  The first triangle specifies the top left,
-	// top right, and bottom left corners of the original image.  The second
-	// triangle specifies the corresponding points of the destination image.
-	// Since the aspect ratio is to be preserved, the same ratio is used to
-	// multiply rows and columns to find the coordinate points.
-
-	cv::Point2f srcTri[3], dstTri[3];
-	srcTri[0] = cv::Point2f(0.f, 0.f);
-	srcTri[1] = cv::Point2f(img.cols - 1.f, 0.f);
-	srcTri[2] = cv::Point2f(0.f, img.rows - 1.f);
-
-	dstTri[0] = cv::Point2f(0.0f, 0.0f);
-	dstTri[1] = cv::Point2f(img.cols * ratio, 0.0f);
-	dstTri[2] = cv::Point2f(0.0f, img.rows * ratio);
-
-	cv::Mat warp_mat = cv::getAffineTransform(srcTri, dstTri);
-
-	// Create the downsampled image and warp the original image into
-	// downsampled image using the affine transform.
-
-	cv::Mat image = cv::Mat::zeros(static_cast<int>( ratio * img.rows ),
-								   static_cast<int>( ratio * img.cols ),
-								   img.type());
-	cv::warpAffine(img, image, warp_mat, image.size());
-
 	// Print the original image resolution on the terminal and display the image.
-	// Wait for the user to press any key, capture that key into response and
-	// return the pressed key.
 
-	std::cout << "\t" << img.cols << "x" << img.rows << std::endl;
-	cv::imshow("Browser", image);
-	uchar response = cv::waitKey();			//!< Key pressed by the user when image is displayed.
-
-	return (response);
+	std::cout << "\t" << frame.cols << "x" << frame.rows << std::endl;
+	StageTimer timer(Stage::show, path);
+	cv::imshow("Browser", frame.image);
+	Stats::reached(Milestone::first_frame);
 }
 
 
@@ -103,6 +94,12 @@ int main( int argc, const char ** argv )
 			return (1);
 		}
 
+		// Time the stages of getting each image on screen if asked to
+
+		std::string stats = parser.get<std::string>("stats");	//!< Where to report timings
+		if (!stats.empty())
+			Stats::enable();
+
 		// Find the maximum number of rows and columns on screen.  If those
 		// are specified in command line, use those.  Otherwise, use the
 		// default values in case of Linux or Apple, or compute to the maximum
@@ -119,64 +116,495 @@ int main( int argc, const char ** argv )
 		}
 #endif
 
-		// Scan all files in the specified directory.  If there are subdirectories,
-		// the files in there are scanned as well in depth-first order.
+		// Scan all files in the specified directory in background.  If there
+		// are subdirectories, the files in there are scanned as well, in
+		// parallel, and listed in depth-first order or sorted by name.  Files
+		// that cannot be images by their extension or first bytes are left
+		// out.  The images are displayed while the scan goes on.  A sort
+		// order, if given, takes the place of the scan order.
+
+		std::string order = parser.get<std::string>("scan-order");	//!< Order of files in list
+		if (order != "dfs" && order != "sorted")
+			throw (std::string("Unknown scan order ") + order);
+		std::string sort_name = parser.get<std::string>("sort");	//!< Sort order, if any
+		SortKey sort = !sort_name.empty() ? parse_sort(sort_name) :
+					   order == "sorted" ? SortKey::name : SortKey::none;
+
+		// To benchmark, run the images through the pipeline without a window,
+		// after writing a synthetic corpus to the directory if asked to.
+
+		bool bench = parser.get<bool>("bench");	//!< Set to benchmark without a window
+		std::string synth = parser.get<std::string>("synth");	//!< Synthetic images to write
+		if (!synth.empty())
+			make_corpus(dir, synth, parser.get<int>("synth-count"));
+
+		// To export, write copies of the images scaled to the size given, or
+		// to the window size, without a window either.
+
+		std::string export_dir = parser.get<std::string>("export");	//!< Directory to export to
+		std::string size_spec = parser.get<std::string>("size");	//!< Size of exported images
+		int erows = maxrows, ecols = maxcols;	//!< Most rows and columns of exported images
+		if (!size_spec.empty())
+		{
+			char x;
+			if (sscanf(size_spec.c_str(), "%d%c%d", &ecols, &x, &erows) != 3 || x != 'x' ||
+				ecols <= 0 || erows <= 0)
+				throw (std::string("Invalid size ") + size_spec);
+		}
+		bool headless = bench || !export_dir.empty();	//!< Set to run without a window
+
+		// Keep the memory held by the caches, the buffer pool, and the zoomed
+		// view together within the global budget, if any, and shed it when
+		// the system runs short of memory.
+
+		MemoryGovernor governor(static_cast<size_t>(parser.get<uint>("mem-budget")) << 20);
+
+		// Recycle the pixel buffers of large images instead of going back to
+		// malloc for every image, and show the previews embedded in JPEG files
+		// when they are big enough unless told otherwise.  Files in a tree
+		// being watched may be cut short while they are decoded, so they are
+		// read rather than mapped.
 
-		std::vector<std::string> files;			//!< List of all files
-		files = file_list(dir, files);
+		FramePool::install(static_cast<size_t>(parser.get<uint>("pool-mb")) << 20);
+		use_previews(parser.get<bool>("exif-preview"));
+		map_files(!parser.get<bool>("watch"));
 
-		assert(files.size() != 0);				// Ensure that the list of files is not empty
+		// Scale large images on the GPU if asked to, once it is set up below.
 
-		// Create window in the top left corner of screen
+		Backend wanted = parse_backend(parser.get<std::string>("backend"));	//!< Backend asked for
 
-		cv::namedWindow("Browser", cv::WINDOW_AUTOSIZE);
-		cv::moveWindow("Browser", 0, 0);
+		// To pass over duplicates, hash each file and each frame as they are
+		// decoded.  The hashes are kept with the frames in the caches.
 
-		// Display each file in the list in order
+		bool dedupe = parser.get<bool>("dedupe");	//!< Set to skip duplicates
+		int near_bits = parser.get<int>("dedupe-bits");	//!< Most bits near duplicates differ in
+		use_hashes(dedupe);
 
-		for (int i = 0; i < files.size(); i++)
+		// Keep the recently displayed images in memory and the previews of all
+		// displayed images on disk, and decode the images around the current
+		// one in background while the current one is on screen.  Benchmarks
+		// leave the disk cache out unless it is named, so that they measure
+		// decoding rather than reading the previews of an earlier run.
+
+		FrameCache cache(static_cast<size_t>(parser.get<uint>("cache-mb")) << 20);
+
+		std::string cache_dir = parser.get<std::string>("disk-cache");	//!< Directory of preview cache
+		if (cache_dir.empty() && !headless)
+			cache_dir = DiskCache::default_dir();
+		std::unique_ptr<DiskCache> disk;
+		if (!cache_dir.empty() && cache_dir != "none")
+			disk.reset(new DiskCache(cache_dir,
+									 static_cast<uint64_t>(parser.get<uint>("disk-cache-mb")) << 20));
+
+		Prefetcher prefetch(parser.get<int>("ahead"), parser.get<int>("behind"),
+							parser.get<int>("readahead"), maxrows, maxcols, cache, disk.get());
+
+		// Watch the tree for files added, changed, and removed while browsing,
+		// if asked to.  Each directory is watched by the scan threads just
+		// before they read it, so that no file written during the scan is
+		// missed and the tree is not walked a second time; files found by both
+		// are listed once.  Files removed are dropped from the list and from the
+		// frames decoded, and files changed are decoded again.
+
+		FileList files;							//!< List of all files
+		std::unique_ptr<DirWatcher> watcher;
+		if (parser.get<bool>("watch"))
 		{
-			cv::Mat img = cv::imread(files[i]);
+			watcher.reset(new DirWatcher(dir, [&files, &cache, &prefetch](const std::string& path) {
+				prefetch.forget(path);
+				cache.erase(path);
+				if (is_image_file(path))
+					files.add(path);
+			}, [&files, &cache, &prefetch](const std::string& path) {
+				files.remove(path);
+				prefetch.forget(path);
+				cache.erase(path);
+			}));
+		}
 
-			// If the file does not contain an image, remove it from the list.
+		// Scan against the index of the tree kept from the last run, if there
+		// is one, so that only the directories that changed are read again.
+
+		std::string index = parser.get<std::string>("index");	//!< Index file of the tree
+		if (index.empty())
+			index = DiskCache::index_file(dir);
+		if (index == "none")
+			index.clear();
+
+		auto start = std::chrono::steady_clock::now();	//!< Time the scan was started
+		std::function<void(const std::string&)> enter;	//!< Called with each directory scanned
+		if (watcher)
+			enter = [&watcher](const std::string& d) { watcher->watch_dir(d); };
+		BackgroundScan scan(dir, sort, parser.get<int>("scan-threads"), files, is_image_file,
+							index, enter);
+
+		// Get the first image on screen as soon as possible.  While the scan
+		// looks for the first file and the prefetcher decodes it, create the
+		// window in the top left corner of screen and set up the GPU to scale
+		// large images on if asked to and one is available.  Images scaled
+		// before the GPU is ready are scaled on the CPU.  In grid mode, the
+		// thumbnails are left for the contact sheet to place.
+
+		bool single = parser.get<std::string>("grid").empty();	//!< Set to show one image at a time
+		std::thread first;						//!< Thread starting on the first file
+		if (!headless)
+		{
+			first = std::thread([&files, &prefetch, single]() {
+				if (!files.wait(0))
+					return;
+				Stats::reached(Milestone::first_file);
+				if (single)
+					prefetch.position(files, 0);
+			});
+		}
 
-			while (img.empty())
+		Backend device;							//!< Backend in use
+		try
+		{
+			if (!headless)
 			{
-				files.erase(files.begin() + i, files.begin() + i + 1);
-				if (i == files.size())
-					return (0);
-				img = cv::imread(files[i]);
+				cv::namedWindow("Browser", cv::WINDOW_AUTOSIZE);
+				cv::moveWindow("Browser", 0, 0);
+				Stats::reached(Milestone::window);
 			}
+			device = use_backend(wanted);
+		}
+		catch (...)
+		{
+			if (first.joinable())
+				first.join();
+			throw;
+		}
+		if (first.joinable())
+			first.join();
 
-			assert(!img.empty());
+		if (device != wanted)
+			std::cerr << "Backend " << backend_name(wanted) << " not available, using "
+					  << backend_name(device) << std::endl;
 
-			// Print the index number and name of the file containing the image.
+		if (!export_dir.empty())
+		{
+			run_export(files, dir, export_dir, erows, ecols, parser.get<std::string>("format"));
+			if (!stats.empty())
+				Stats::report(stats);
+			return (0);
+		}
 
-			std::cout << std::setw(5) << i << ". " << std::setw(60) << files[i];
+		if (bench)
+		{
+			run_bench(files, prefetch, start);
+			if (!stats.empty())
+				Stats::report(stats);
+			return (0);
+		}
 
-			uchar response = display(img);		//!< User response (valid values: q, n, p, space)
+		// In grid mode, browse pages of thumbnails, and show an image at full
+		// size when it is picked.
 
-			if (response == 'q')				// User pressed q; quit
-				break;
+		std::string grid_spec = parser.get<std::string>("grid");	//!< Thumbnails across and down
+		std::unique_ptr<ContactSheet> sheet;
+		if (!grid_spec.empty())
+		{
+			int gcols, grows;					//!< Number of thumbnails across and down
+			char x;
+			if (sscanf(grid_spec.c_str(), "%d%c%d", &gcols, &x, &grows) != 3 || x != 'x' ||
+				gcols <= 0 || grows <= 0 || gcols > maxcols || grows > maxrows)
+				throw (std::string("Invalid grid ") + grid_spec);
+			sheet.reset(new ContactSheet(gcols, grows, maxrows, maxcols,
+										 parser.get<int>("readahead"), cache, disk.get()));
+		}
+		bool grid = sheet != nullptr;			//!< Set while browsing thumbnails
+
+		// Display each file in the list in order, waiting for the scan to find
+		// the next file when the display catches up with it.  Keys are polled
+		// with a short timeout rather than waited for, so that the window is
+		// updated as soon as a decode or the scan makes progress, and keys
+		// pressed while the next image is still being decoded move on without
+		// waiting for it.  Holding down a key thus skips the images that are
+		// not ready in time instead of queueing up behind their decodes.
+
+		const int tick = 10;					//!< Milliseconds to wait for a key at a time
+		const size_t skip = 100;				//!< Number of files Page Up and Page Down skip
+
+		size_t i = 0;							//!< Index of the file to display
+		int step = 1;							//!< Direction to look in for an image
+		size_t shown = SIZE_MAX;				//!< Index of the file on screen
+		size_t rough = SIZE_MAX;				//!< Index of the file shown rough, if any
+		size_t target = SIZE_MAX;				//!< Index the prefetch window is around
+		size_t known = 0;						//!< Number of files when the window was placed
+		std::unique_ptr<ZoomView> view;			//!< Zoomed view of the image on screen, if any
+		size_t zoom_budget = static_cast<size_t>(parser.get<uint>("zoom-mb")) << 20;	//!< Zoom memory
+		std::unordered_set<uint64_t> seen;		//!< Content hashes of the images shown
+		uint64_t last = 0;						//!< Perceptual hash of the image on screen
+		std::string number;						//!< Digits typed of an index to go to
+		std::string query;						//!< Text of a file name searched for
+		bool searching = false;					//!< Set while a search is being typed
+		bool waiting = false;					//!< Set while a key press is not answered
+		std::chrono::steady_clock::time_point pressed;	//!< Time of the first key not answered
+
+		while (files.wait(i))
+		{
+			if (grid)
+			{
+				if (!sheet->browse(files, i))
+					break;
+				grid = false;
+				step = 1;
+				shown = SIZE_MAX;
+				waiting = false;
+				continue;
+			}
 
-			if (response == 'n' || response == ' ') // User pressed n or space; display next image
+			// Move the prefetch window when the position changes, and fill it
+			// up as the scan finds more files.
+
+			if (!files.dropped(i) && (i != target || files.size() != known))
+			{
+				prefetch.position(files, i);
+				target = i;
+				known = files.size();
+			}
+
+			// If the file does not contain an image, drop it from the list and
+			// keep looking in the same direction.  Looking back from the first
+			// file turns around.
+
+			Frame frame;
+			bool ready = files.dropped(i) || prefetch.poll(files[i], frame);	//!< Set if decoded
+
+			if (ready && frame.image.empty())
+			{
+				files.drop(i);
+				if (step < 0 && i == 0)
+					step = 1;
+				i += step;
 				continue;
+			}
 
-			if (response == 'p')				// User pressed p; display previous image
+			// With dedupe, pass over exact copies of images already shown on
+			// the way forward, and images that look like the one on screen in
+			// either direction, such as burst shots and re-exports.
+
+			if (dedupe && ready && i != shown && shown != SIZE_MAX && !(step < 0 && i == 0) &&
+				((step > 0 && seen.count(frame.digest)) ||
+				 (frame.dhash && hamming(frame.dhash, last) <= near_bits)))
 			{
-				if (i == 0)
+				std::cout << std::setw(5) << i << ". " << std::setw(60) << files[i]
+						  << "\tduplicate" << std::endl;
+				i += step;
+				continue;
+			}
+
+			// Until the image is ready, show a rough version of it that
+			// decodes in a few milliseconds, unless it may turn out to be a
+			// duplicate.  The image replaces it once decoded.
+
+			if (!ready && i != shown && i != rough && !dedupe)
+			{
+				const std::string path = files[i];	//!< Name of the file shown rough
+				Frame quick = quick_frame(path, maxrows, maxcols);	//!< Rough frame
+				if (!quick.image.empty())
 				{
-					i--;
+					StageTimer timer(Stage::show, path);
+					cv::imshow("Browser", quick.image);
+					Stats::reached(Milestone::first_frame);
 				}
+				rough = i;
+			}
+
+			// Print the index number and name of the file containing the
+			// image, and display it once it is ready.
+
+			if (ready && i != shown)
+			{
+				std::cout << std::setw(5) << i << ". " << std::setw(60) << files[i];
+				display(files[i], frame);
+				shown = i;
+				rough = SIZE_MAX;
+				view.reset();
+				if (frame.digest)
+					seen.insert(frame.digest);
+				last = frame.dhash;
+				if (waiting)
+					Stats::record(Stage::key, std::chrono::duration<double, std::milli>(
+									  std::chrono::steady_clock::now() - pressed).count(), files[i]);
+				waiting = false;
+			}
+
+			int response = read_key(tick);		//!< User response (valid values: q, n, p, space)
+
+			if (response < 0)					// Nothing pressed yet; look again
+				continue;
+
+			// Typing / and part of a file name goes to the next file whose
+			// name has it, for each character typed, until Enter or Esc ends
+			// the search.  Typing digits and Enter goes to the file of that
+			// index.  Like any other move, a jump moves the prefetch window at
+			// once, so the decodes queued for the files passed over are called
+			// off rather than waited for.
+
+			if (searching)
+			{
+				if (response == 27 || response == '\r' || response == '\n')
+				{
+					searching = false;
+					continue;
+				}
+				if (response == 8 || response == 127)
+				{
+					if (!query.empty())
+						query.pop_back();
+				}
+				else if (response >= ' ' && response < 127)
+				{
+					query += static_cast<char>(response);
+				}
+				else
+				{
+					continue;
+				}
+				std::cout << "/" << query << std::endl;
+
+				size_t found = query.empty() ? SIZE_MAX : files.find(query, i);	//!< File matching
+				if (found != SIZE_MAX && found != i)
+				{
+					if (!waiting)
+						pressed = std::chrono::steady_clock::now();
+					waiting = true;
+					i = found;
+					step = 1;
+				}
+				continue;
+			}
+
+			if (response == '/')				// User pressed /; search for a file name
+			{
+				searching = true;
+				query.clear();
+				number.clear();
+				std::cout << "/" << std::endl;
+				continue;
+			}
+
+			if (response >= '0' && response <= '9')	// User typed a digit of an index
+			{
+				if (number.size() < 18)
+					number += static_cast<char>(response);
+				std::cout << "Go to " << number << std::endl;
+				continue;
+			}
+
+			if (!number.empty() && (response == '\r' || response == '\n'))
+			{
+				if (!waiting)
+					pressed = std::chrono::steady_clock::now();
+				waiting = true;
+				i = std::min(static_cast<size_t>(std::stoull(number)), files.size() - 1);
+				step = 1;
+				number.clear();
+				continue;
+			}
+			number.clear();
+
+			// Zoom in and out of the image on screen with + and -, and pan
+			// around it with the arrow keys or h, j, k, and l while zoomed in.
+			// The image is decoded again only at the resolution the zoom needs.
+
+			int dx = (response == KEY_RIGHT || response == 'l') -
+					 (response == KEY_LEFT || response == 'h');	//!< Quarters to pan right
+			int dy = (response == KEY_DOWN || response == 'j') -
+					 (response == KEY_UP || response == 'k');	//!< Quarters to pan down
+			bool zoomed = view && view->zoomed();	//!< Set if the view is zoomed in
+
+			if (ready && shown == i &&
+				(response == '+' || response == '=' || (zoomed && (response == '-' || dx || dy))))
+			{
+				if (!view)
+					view.reset(new ZoomView(files[i], frame.cols, frame.rows, maxrows, maxcols,
+											zoom_budget));
+				if (response == '+' || response == '=')
+					view->zoom_in();
+				else if (response == '-')
+					view->zoom_out();
 				else
+					view->pan(dx, dy);
+
+				// An image too big for the zoom budget cannot be zoomed in;
+				// the view on screen stays as it is.
+
+				cv::Mat img = view->zoomed() ? view->render() : frame.image;	//!< Image to show
+				if (!img.empty())
+				{
+					StageTimer timer(Stage::show, files[i]);
+					cv::imshow("Browser", img);
+				}
+				else if (response == '+' || response == '=')
 				{
-					i -= 2;
+					view->zoom_out();
 				}
 				continue;
 			}
+
+			if (!waiting)
+				pressed = std::chrono::steady_clock::now();
+			waiting = true;
+
+			if (response == 'q')				// User pressed q; quit
+				break;
+
+			if (response == 'g' && sheet)		// User pressed g; go back to thumbnails
+			{
+				grid = true;
+				continue;
+			}
+
+			if (response == KEY_HOME)			// User pressed Home; display first image
+			{
+				step = 1;
+				i = 0;
+				continue;
+			}
+
+			if (response == KEY_END)			// User pressed End; display last image found
+			{
+				step = -1;
+				i = files.size() - 1;
+				continue;
+			}
+
+			if (response == KEY_PAGE_DOWN || response == ']')	// Skip ahead
+			{
+				step = 1;
+				i = std::min(i + skip, files.size() - 1);
+				continue;
+			}
+
+			if (response == KEY_PAGE_UP || response == '[')	// Skip back
+			{
+				step = -1;
+				i = i > skip ? i - skip : 0;
+				continue;
+			}
+
+			if (response == 'p')				// User pressed p; display previous image
+			{
+				step = -1;
+				if (i > 0)
+					i--;
+				continue;
+			}
+
+			step = 1;							// User pressed n, space, or any other key;
+			i++;								// display next image
 		}
 
 		cv::destroyAllWindows();			// All done, remove the display window
+
+		if (!stats.empty())					// Report the timings if asked to
+			Stats::report(stats);
+
+		if (!files.error().empty())			// Report an error that cut the scan short
+			throw (files.error());
 	}
 	catch (std::string& str)				// Handle string exception
 	{
@@ -5,6 +5,32 @@
 //!< keys contains possible arguments and their default values
 //!< rows defaults to 0 in Windows and 720 in Linux or Apple
 //!< cols defaults to 0 in Windows and 1280 in Linux or Apple
+//!< ahead is the number of images decoded in background after the one on screen
+//!< behind is the number of images decoded in background before the one on screen
+//!< readahead is the number of images after those prefetched read into memory
+//!< cache-mb is the memory in MB for images kept after they are displayed
+//!< scan-threads is the number of threads reading directories, 0 for one per core
+//!< scan-order is dfs for depth-first order or sorted for order by path name
+//!< sort is name, natural, mtime, size, or exif-date, and overrides scan-order
+//!< pool-mb is the memory in MB of freed image buffers kept for reuse
+//!< grid shows COLSxROWS thumbnails per page instead of one image, e.g. 6x4
+//!< zoom-mb is the memory in MB for the levels of an image decoded to zoom in
+//!< mem-budget is the memory in MB for all of the above together, 0 for no limit but pressure
+//!< dedupe skips copies of images shown and images looking like the one on screen
+//!< dedupe-bits is the most bits the perceptual hashes of look-alike images differ in
+//!< backend is cpu, or opencl or cuda to scale large images on the GPU when available
+//!< exif-preview uses the previews embedded in JPEG files when big enough
+//!< stats reports stage timings to stderr, or to a .csv or .json file if named
+//!< bench runs the images through the pipeline without a window and reports speed
+//!< synth writes synthetic images to the directory first, e.g. jpg:6000x4000,png:1920x1080
+//!< synth-count is the number of synthetic images of each format and size
+//!< export writes scaled copies of the images to the directory named instead of showing them
+//!< size is the most columns and rows of exported images, e.g. 1920x1080, or the window size
+//!< format is the format of exported images: jpg, webp, or png
+//!< watch keeps the list up to date with files added and removed while browsing
+//!< index is the file keeping the directory tree between runs, or none to scan it all
+//!< disk-cache defaults to ~/.cache/image_browser, or none to disable it
+//!< disk-cache-mb is the most MB of previews kept, the oldest removed first, 0 for no limit
 
 const std::string keys =
 {
@@ -16,5 +42,31 @@ const std::string keys =
 	"{rows r			| 720  | Max number of rows on screen					}"
 	"{cols c			|1280  | Max number of columns on screen				}"
 #endif
+	"{scan-threads		|  0   | Number of threads scanning directories			}"
+	"{scan-order		| dfs  | Order of files: dfs or sorted					}"
+	"{sort				|      | Sort by name, natural, mtime, size, exif-date	}"
+	"{grid g			|      | Pages of COLSxROWS thumbnails, e.g. 6x4		}"
+	"{ahead a			|  4   | Number of images to prefetch ahead				}"
+	"{behind b			|  2   | Number of images to prefetch behind			}"
+	"{readahead			|  8   | Number of images to read ahead from disk		}"
+	"{cache-mb			| 512  | Memory for recently displayed images in MB		}"
+	"{pool-mb			| 256  | Memory for image buffers kept for reuse in MB	}"
+	"{zoom-mb			| 512  | Memory for zoomed-in levels of an image in MB	}"
+	"{mem-budget		|  0   | Memory for all images together in MB, 0 for none	}"
+	"{dedupe			| false| Skip duplicate and near-duplicate images		}"
+	"{dedupe-bits		|  6   | Most bits near duplicates differ in, of 64		}"
+	"{backend			| cpu  | Scale images on cpu, opencl, or cuda			}"
+	"{exif-preview		| true | Use previews embedded in JPEG files				}"
+	"{watch				| false| Watch the directory for files added or removed	}"
+	"{index				|      | Index file of the directory tree, or none		}"
+	"{disk-cache		|      | Directory for previews kept across runs, or none	}"
+	"{disk-cache-mb		| 1024 | Most previews kept on disk in MB, 0 for no limit	}"
+	"{stats				|      | Report timings to stderr, or a .csv/.json file	}"
+	"{bench				| false| Benchmark without a window						}"
+	"{synth				|      | Write FORMAT:COLSxROWS,... synthetic images	}"
+	"{synth-count		|  10  | Number of synthetic images of each kind		}"
+	"{export			|      | Write scaled copies of the images to DIR		}"
+	"{size				|      | Most COLSxROWS of exported images				}"
+	"{format			| jpg  | Format of exported images: jpg, webp, or png	}"
 	"{@directory		|<none>| Directory that contains the pictures to browse	}"
 };
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include "frame.hpp"
+#include "governor.hpp"
+#include "cache.hpp"
+#include "dir.hpp"
+#include "stats.hpp"
+
+/******************************************************************************
+ * \brief Create an empty cache
+ *
+ * @param [in] budget maximum number of bytes of pixel data held by the cache
+ *****************************************************************************/
+
+FrameCache::FrameCache(size_t budget) :
+	budget(budget)
+{
+	MemoryGovernor::enroll(this, 1);
+}
+
+/******************************************************************************
+ * \brief Destroy the cache
+ *****************************************************************************/
+
+FrameCache::~FrameCache()
+{
+	MemoryGovernor::leave(this);
+}
+
+/******************************************************************************
+ * \brief Find the priority of a frame that is used now
+ *
+ * Must be called with lock held.  Frames whose time to load is unknown count
+ * as loaded in a tenth of a millisecond, so that they are evicted first.
+ *
+ * @param [in] e entry of the frame
+ * \return priority of the frame
+ *****************************************************************************/
+
+double FrameCache::priority(const Entry& e) const
+{
+	return (inflation + std::max(e.frame.cost, 0.1f) / std::max(e.bytes, static_cast<size_t>(1)));
+}
+
+/******************************************************************************
+ * \brief Evict frames with the lowest priority
+ *
+ * Must be called with lock held.  The inflation value rises to the priority
+ * of each frame evicted.
+ *
+ * @param [in] limit number of bytes to hold at most
+ *****************************************************************************/
+
+void FrameCache::evict(size_t limit)
+{
+	while (used > limit && !order.empty())
+	{
+		auto victim = order.begin();
+		auto it = index.find(victim->second);
+		inflation = victim->first;
+		used -= it->second.bytes;
+		Stats::add(Counter::evicted);
+		Stats::add(Counter::evicted_bytes, it->second.bytes);
+		index.erase(it);
+		order.erase(victim);
+	}
+}
+
+/******************************************************************************
+ * \brief Build the key for a file
+ *
+ * The key combines the name of the file, its modification time, and the size
+ * of the display window.  If the file cannot be stat'ed, an empty key is
+ * returned and the file is never cached.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return key for the file, or empty string
+ *****************************************************************************/
+
+std::string FrameCache::key(const std::string& path, int maxrows, int maxcols)
+{
+	struct stat buf;
+	if (stat(path.c_str(), &buf) != 0)
+		return (std::string());
+
+	return (path + "|" + std::to_string(static_cast<long long>(buf.st_mtime)) +
+			"|" + std::to_string(maxcols) + "x" + std::to_string(maxrows));
+}
+
+/******************************************************************************
+ * \brief Look up a frame in the cache
+ *
+ * If the frame is found, it gets a fresh priority.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [out] frame frame found in the cache
+ * \return true if the frame was found, false otherwise
+ *****************************************************************************/
+
+bool FrameCache::get(const std::string& path, int maxrows, int maxcols, Frame& frame)
+{
+	if (budget == 0)
+		return (false);
+
+	std::string k = key(path, maxrows, maxcols);
+	if (k.empty())
+		return (false);
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto it = index.find(k);
+	if (it == index.end())
+		return (false);
+
+	Entry& e = it->second;
+	order.erase(e.place);
+	e.place = order.emplace(priority(e), k);
+	frame = e.frame;
+
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Add a frame to the cache
+ *
+ * Frames with the lowest priority are evicted until the cache fits in its
+ * budget, and then the memory governor is asked to keep to the global
+ * budget.  Empty frames and frames bigger than the whole budget are not
+ * cached.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [in] frame frame to be cached
+ *****************************************************************************/
+
+void FrameCache::put(const std::string& path, int maxrows, int maxcols, const Frame& frame)
+{
+	size_t bytes = frame.image.total() * frame.image.elemSize();
+	if (frame.image.empty() || bytes > budget)
+		return;
+
+	std::string k = key(path, maxrows, maxcols);
+	if (k.empty())
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto it = index.find(k);
+		if (it != index.end())
+		{
+			used -= it->second.bytes;
+			order.erase(it->second.place);
+			index.erase(it);
+		}
+
+		Entry& e = index[k];
+		e.frame = frame;
+		e.bytes = bytes;
+		e.place = order.emplace(priority(e), k);
+		used += bytes;
+
+		evict(budget);
+	}
+
+	MemoryGovernor::balance();
+}
+
+/******************************************************************************
+ * \brief Drop the frames of a file, or of all files in a directory
+ *
+ * Frames of every modification time and window size are dropped.
+ *
+ * @param [in] path name of the file or directory
+ *****************************************************************************/
+
+void FrameCache::erase(const std::string& path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	for (auto it = index.begin(); it != index.end(); )
+	{
+		const std::string& k = it->first;
+		size_t end = k.rfind('|', k.rfind('|') - 1);	//!< End of the file name
+		if (in_tree(k.substr(0, end), path))
+		{
+			used -= it->second.bytes;
+			order.erase(it->second.place);
+			it = index.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+/******************************************************************************
+ * \brief Find the memory held by the cache
+ *
+ * \return number of bytes of pixel data held
+ *****************************************************************************/
+
+size_t FrameCache::held() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (used);
+}
+
+/******************************************************************************
+ * \brief Evict frames for the memory governor
+ *
+ * @param [in] bytes number of bytes to release
+ * \return number of bytes released
+ *****************************************************************************/
+
+size_t FrameCache::shed(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	size_t before = used;
+	evict(used > bytes ? used - bytes : 0);
+	return (before - used);
+}
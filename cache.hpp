@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+/******************************************************************************
+ * \brief Memory cache of frames ready for display
+ *
+ * The cache keeps frames, already scaled to the size of the display window,
+ * up to a budget in bytes.  Frames are looked up by the name of the file, its
+ * modification time, and the size of the window they were scaled for, so
+ * that a file modified while browsing is decoded again.
+ *
+ * When the budget is exceeded, frames are evicted by what keeping them saves
+ * per byte, with the GreedyDual-Size policy: each frame has a priority of the
+ * time it took to load divided by its size, plus an inflation value, and the
+ * frame with the lowest priority goes first.  The inflation value rises to
+ * the priority of each frame evicted, and a frame gets a fresh priority when
+ * it is used, so frames that are not used age out however costly they were,
+ * while frames cheap to load again, such as those read from the disk cache,
+ * go before full decodes of the same size.  The cache enrolls with the memory
+ * governor, which may ask it to shed frames the same way to keep to the
+ * global budget.  All functions can be called from any thread.
+ *****************************************************************************/
+
+class FrameCache : public MemoryGovernor::Consumer
+{
+public:
+	explicit FrameCache(size_t budget);
+	~FrameCache();
+
+	bool get(const std::string& path, int maxrows, int maxcols, Frame& frame);
+	void put(const std::string& path, int maxrows, int maxcols, const Frame& frame);
+	void erase(const std::string& path);
+
+	size_t held() const override;
+	size_t shed(size_t bytes) override;
+
+private:
+	//!< Cached frame along with its priority
+	struct Entry
+	{
+		Frame frame;			//!< Frame scaled to fit the window
+		size_t bytes;			//!< Size of the pixel data in frame
+		std::multimap<double, std::string>::iterator place;	//!< Position in order
+	};
+
+	static std::string key(const std::string& path, int maxrows, int maxcols);
+	double priority(const Entry& e) const;
+	void evict(size_t limit);
+
+	size_t budget;				//!< Maximum number of bytes held by the cache
+	size_t used = 0;			//!< Number of bytes held by the cache
+	double inflation = 0;		//!< Priority of the last frame evicted
+	std::multimap<double, std::string> order;	//!< Keys by priority, lowest first
+	std::unordered_map<std::string, Entry> index;	//!< Entries by key, made from file name,
+												//   mtime, and window size
+	mutable std::mutex lock;	//!< Protects all of the above
+};
@@ -1,4 +1,14 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <string>
 #include <string.h>
@@ -12,8 +22,15 @@
 #endif
 
 #include "dir.hpp"
+#include "stats.hpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#endif
 
 #if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -24,7 +41,8 @@
  * In Linux and Apple, the comparison of file attribute to DT_DIR depends on
  * the underlying file system and is not guaranteed to work on all file
  * systems.  Therefore, we use the bulletproof function lstat to determine if
- * the file name refers to a directory.
+ * the file name refers to a directory.  A file that cannot be lstat'ed is not
+ * a directory.
  *
  * @param [in] filename refers to the name of file to check if it's a directory
  * \return true if the filename refers to a directory, false otherwise.
@@ -33,26 +51,143 @@
 bool is_directory ( const std::string& filename )
 {
     struct stat buf;
-    lstat ( filename.c_str(), &buf );
+    if ( lstat ( filename.c_str(), &buf ) != 0 )
+        return ( false );
+    return ( S_ISDIR ( buf.st_mode ) );
+}
+
+/******************************************************************************
+ * \brief Find out if a directory entry refers to a directory
+ *
+ * Most file systems (ext4, xfs, btrfs, APFS) fill in d_type, which tells the
+ * type of the entry without another system call.  Only when d_type is
+ * DT_UNKNOWN do we fall back to fstatat relative to the open directory, which
+ * saves resolving the path again.  As with lstat, symbolic links are not
+ * followed, and an entry that cannot be stat'ed is not a directory.
+ *
+ * @param [in] dir directory being read
+ * @param [in] ent entry read from dir
+ * \return true if the entry refers to a directory, false otherwise.
+ * \sa is_directory()
+ *****************************************************************************/
+
+static bool is_directory ( DIR* dir, const struct dirent* ent )
+{
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
+    if ( ent->d_type != DT_UNKNOWN )
+        return ( ent->d_type == DT_DIR );
+#endif
+
+    struct stat buf;
+    if ( fstatat ( dirfd ( dir ), ent->d_name, &buf, AT_SYMLINK_NOFOLLOW ) != 0 )
+        return ( false );
     return ( S_ISDIR ( buf.st_mode ) );
 }
 #endif
 
 /******************************************************************************
- * \brief Create a list of files in directory
+ * \brief Create a directory and any missing parent directories
  *
- * Given a directory, scan it in depth-first order and produce a list of files
- * contained therein.  Traverse any subdirectory but do not save the name of
- * subdirectory.  All the files are relative to current working directory.
- * Throws an exception if directory cannot be opened.
+ * @param [in] dir name of the directory
+ *****************************************************************************/
+
+void make_dirs(const std::string& dir)
+{
+	for (size_t pos = dir.find_first_of("/\\", 1); ; pos = dir.find_first_of("/\\", pos + 1))
+	{
+		std::string part = dir.substr(0, pos);
+#ifdef _WIN32
+		_mkdir(part.c_str());
+#else
+		mkdir(part.c_str(), 0755);
+#endif
+		if (pos == std::string::npos)
+			break;
+	}
+}
+
+/******************************************************************************
+ * \brief Write a file whole or not at all
+ *
+ * The contents are written under a temporary name unique to the process, the
+ * thread, and the call, and the file is then renamed into place, so that a
+ * reader or a later run never sees a partial file and writers of the same
+ * file at once do not clash.  The directory of the file is created if need
+ * be.  If writing fails, the temporary file is removed and the file left as
+ * it was.
+ *
+ * @param [in] path name of the file
+ * @param [in] write function writing the contents to the stream it is given
+ * \return true if the file was written, false otherwise
+ *****************************************************************************/
+
+bool replace_file(const std::string& path, const std::function<void(std::ostream&)>& write)
+{
+	static std::atomic<unsigned> serial(0);	//!< Number of temporary files named so far
+
+	size_t slash = path.find_last_of("/\\");
+	if (slash != std::string::npos && slash > 0)
+		make_dirs(path.substr(0, slash));
+
+#ifdef _WIN32
+	long pid = static_cast<long>(_getpid());
+#else
+	long pid = static_cast<long>(getpid());
+#endif
+	std::string tmp = path + ".tmp" + std::to_string(pid) + "." +
+					  std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+					  "." + std::to_string(serial++);	//!< Name to write under
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		write(out);
+		if (!out)
+		{
+			out.close();
+			remove(tmp.c_str());
+			return (false);
+		}
+	}
+
+#ifdef _WIN32
+	remove(path.c_str());			// rename does not replace files in Windows
+#endif
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+		return (false);
+	}
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Find out if a file is the specified one or is under it
+ *
+ * @param [in] path name of the file
+ * @param [in] top name of a file or of a directory
+ * \return true if path is top or is in the tree under top, false otherwise
+ *****************************************************************************/
+
+bool in_tree(const std::string& path, const std::string& top)
+{
+	return (path.compare(0, top.size(), top) == 0 &&
+			(path.size() == top.size() || path[top.size()] == '/' || path[top.size()] == '\\'));
+}
+
+/******************************************************************************
+ * \brief Read the entries of a single directory
+ *
+ * Call entry with the name of each entry in the directory, relative to
+ * current working directory, and whether it is a directory.  The entries .
+ * and .. are skipped.  Throws an exception if directory cannot be opened.
  *
  * @param [in] dirname name of the directory
- * @param [in,out] files list of files
- * \return list of files as a vector of strings
+ * @param [in] entry function called with the name of each entry and true if
+ *             the entry is a directory
  * \sa is_directory()
  *****************************************************************************/
 
-std::vector<std::string> file_list(const std::string& dirname, std::vector<std::string>& files)
+void read_dir(const std::string& dirname,
+			  const std::function<void(const std::string&, bool)>& entry)
 {
 	DIR* dir;				//!< dir Variable to hold opened directory
 	struct dirent* ent;		//!< ent Variable to hold an entry in directory
@@ -83,24 +218,540 @@ std::vector<std::string> file_list(const std::string& dirname, std::vector<std::
 		std::string file_name = dirname + std::string("/") + std::string(ent->d_name);
 #endif
 
-		// Make a recursive call in case of directory; otherwise, append file_name
-		// to list of files
-
 #ifdef _WIN32
-		if (ent->d_type == DT_DIR)
+		bool subdir = ent->d_type == DT_DIR;
 #elif defined(__linux__) || defined(__APPLE__)
-		if ( is_directory ( file_name ) )
+		bool subdir = is_directory ( dir, ent );
 #endif
+
+		try
 		{
-			files = file_list(file_name, files);
+			entry(file_name, subdir);
 		}
-		else
+		catch (...)
 		{
-			files.push_back(file_name);
+			closedir(dir);
+			throw;
 		}
 	}
 
+	closedir(dir);
+}
+
+/******************************************************************************
+ * \brief Visit the files in directory
+ *
+ * Given a directory, scan it in depth-first order and call visit with the
+ * name of each file contained therein.  Traverse any subdirectory but do not
+ * visit the name of subdirectory.  All the files are relative to current
+ * working directory.  Throws an exception if directory cannot be opened.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in] visit function called with the name of each file
+ *****************************************************************************/
+
+void scan_dir(const std::string& dirname, const std::function<void(const std::string&)>& visit)
+{
+	// Make a recursive call in case of directory; otherwise, visit file_name
+
+	read_dir(dirname, [&visit](const std::string& file_name, bool subdir) {
+		if (subdir)
+			scan_dir(file_name, visit);
+		else
+			visit(file_name);
+	});
+}
+
+/******************************************************************************
+ * \brief Append the files in directory to a list
+ *
+ * Scan the directory as scan_dir() does and append the name of each file to
+ * the list in place, so that the list is never copied however deep the
+ * directory tree is.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in,out] files list of files to append to
+ * \sa scan_dir()
+ *****************************************************************************/
+
+void scan_dir(const std::string& dirname, std::vector<std::string>& files)
+{
+	scan_dir(dirname, [&files](const std::string& file_name) { files.push_back(file_name); });
+}
+
+/******************************************************************************
+ * \brief Create a list of files in directory
+ *
+ * Wrapper around scan_dir() kept for existing callers.  The files are
+ * appended to files in place, and a copy of the whole list is returned.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in,out] files list of files
+ * \return list of files as a vector of strings
+ * \sa scan_dir()
+ *****************************************************************************/
+
+std::vector<std::string> file_list(const std::string& dirname, std::vector<std::string>& files)
+{
+	scan_dir(dirname, files);
 	return (files);
 }
 
+namespace {
+
+/******************************************************************************
+ * \brief Directory visited by the parallel scanner
+ *
+ * Each directory is read by one thread, which records its files and where
+ * each subdirectory falls among them, so that the files can be handed out in
+ * depth-first order no matter which thread reads which directory.
+ *****************************************************************************/
+
+struct ScanNode
+{
+	std::string path;					//!< Name of the directory
+	void* tag = nullptr;				//!< Tag of the directory for the lister, if any
+	std::vector<std::string> files;		//!< Files in the directory, in readdir order
+	std::vector<std::pair<size_t, ScanNode*>> children;	//!< Number of files read before
+														//   each subdirectory, and its node
+	bool done = false;					//!< Set when the directory has been read
+};
+
+/******************************************************************************
+ * \brief Directory scanner spreading subdirectories across threads
+ *
+ * Every thread has its own queue of directories to read.  A thread pushes
+ * the subdirectories it finds on the back of its own queue and takes its next
+ * directory from the back as well, so it walks its part of the tree depth
+ * first.  A thread whose queue is empty steals from the front of the other
+ * queues, which holds the directories nearest the root and therefore the
+ * largest pieces of work.
+ *
+ * Files are handed out in depth-first order as soon as every directory that
+ * comes before them in that order has been read.  A cursor holds the path
+ * from the root to the directory whose files are being handed out; it moves
+ * forward each time a thread finishes a directory.
+ *****************************************************************************/
+
+class ParallelScan
+{
+public:
+	ParallelScan(int nthreads, const std::function<void(const std::string&)>& visit,
+				 const std::function<bool(const std::string&)>& filter,
+				 const std::atomic<bool>* cancel, DirLister* lister = nullptr,
+				 const std::function<void(const std::string&)>& enter = nullptr);
+
+	void run(const std::string& dirname,
+			 const std::function<void(const std::vector<std::string>&)>& first_batch,
+			 void* tag = nullptr);
+
+private:
+	//!< Queue of directories owned by one thread
+	struct Queue
+	{
+		std::mutex lock;				//!< Protects dirs
+		std::deque<ScanNode*> dirs;		//!< Directories to read
+	};
+
+	//!< Position of the cursor within one directory
+	struct Cursor
+	{
+		ScanNode* node;					//!< Directory
+		size_t file;					//!< Next file to hand out
+		size_t child;					//!< Next subdirectory to descend into
+	};
 
+	ScanNode* add(const std::string& path, void* tag);
+	void push(int self, ScanNode* node);
+	bool next(int self, ScanNode*& node);
+	void advance();
+	bool stopped() const;
+	void worker(int self);
+
+	int nthreads;						//!< Number of scanning threads
+	std::function<void(const std::string&)> visit;	//!< Called with each file in order
+	std::function<bool(const std::string&)> filter;	//!< Tells which files to keep, or nullptr
+	std::function<void(const std::vector<std::string>&)> first_batch;	//!< Called after root is read
+	const std::atomic<bool>* cancel;	//!< Set by the caller to stop the scan, or NULL
+	DirLister* lister;					//!< Gives the entries of each directory, or NULL
+										//   to read them and run filter
+	std::function<void(const std::string&)> enter;	//!< Called with each directory before
+												//   it is listed, or nullptr
+	ScanNode* root = nullptr;			//!< Root directory
+	std::deque<ScanNode> nodes;			//!< All directories found so far
+	std::mutex nodes_lock;				//!< Protects the structure of nodes
+	std::vector<Queue> queues;			//!< One queue per thread
+	std::vector<Cursor> cursor;			//!< Path from root to the files being handed out
+	std::mutex cursor_lock;				//!< Protects cursor, and serializes visit
+	std::atomic<size_t> pending;		//!< Directories queued or being read
+	std::mutex idle_lock;				//!< Used with idle
+	std::condition_variable idle;		//!< Signalled when work is queued or done
+	std::atomic<bool> failed;			//!< Set when a thread hit an error
+	std::string error;					//!< First error hit, valid if failed
+};
+
+/******************************************************************************
+ * \brief Prepare a scanner
+ *
+ * @param [in] nthreads number of threads to use
+ * @param [in] visit function called with the name of each file
+ * @param [in] filter function telling which files to visit, or nullptr
+ * @param [in] cancel flag set by the caller to stop the scan, or NULL
+ * @param [in] lister source of the entries of each directory, or NULL to read
+ *             the directories and run filter on their files
+ * @param [in] enter function called with each directory before it is
+ *             listed, or nullptr
+ *****************************************************************************/
+
+ParallelScan::ParallelScan(int nthreads, const std::function<void(const std::string&)>& visit,
+						   const std::function<bool(const std::string&)>& filter,
+						   const std::atomic<bool>* cancel, DirLister* lister,
+						   const std::function<void(const std::string&)>& enter) :
+	nthreads(nthreads), visit(visit), filter(filter), cancel(cancel), lister(lister),
+	enter(enter), queues(nthreads), pending(0), failed(false)
+{
+}
+
+/******************************************************************************
+ * \brief Record a new directory
+ *
+ * Elements of a deque do not move when more are appended, so the node can be
+ * filled in without holding the lock.
+ *
+ * @param [in] path name of the directory
+ * @param [in] tag tag of the directory for the lister
+ * \return the new node
+ *****************************************************************************/
+
+ScanNode* ParallelScan::add(const std::string& path, void* tag)
+{
+	std::lock_guard<std::mutex> guard(nodes_lock);
+	nodes.push_back(ScanNode());
+	nodes.back().path = path;
+	nodes.back().tag = tag;
+	return (&nodes.back());
+}
+
+/******************************************************************************
+ * \brief Queue a directory on the queue of a thread
+ *
+ * @param [in] self thread that found the directory
+ * @param [in] node the directory
+ *****************************************************************************/
+
+void ParallelScan::push(int self, ScanNode* node)
+{
+	pending++;
+	{
+		std::lock_guard<std::mutex> guard(queues[self].lock);
+		queues[self].dirs.push_back(node);
+	}
+	idle.notify_one();
+}
+
+/******************************************************************************
+ * \brief Find the next directory for a thread to read
+ *
+ * Take the most recently queued directory from the thread's own queue, or
+ * steal the least recently queued one from another thread.
+ *
+ * @param [in] self thread looking for work
+ * @param [out] node the directory to read
+ * \return true if a directory was found, false otherwise
+ *****************************************************************************/
+
+bool ParallelScan::next(int self, ScanNode*& node)
+{
+	{
+		std::lock_guard<std::mutex> guard(queues[self].lock);
+		if (!queues[self].dirs.empty())
+		{
+			node = queues[self].dirs.back();
+			queues[self].dirs.pop_back();
+			return (true);
+		}
+	}
+
+	for (int k = 1; k < nthreads; k++)
+	{
+		Queue& victim = queues[(self + k) % nthreads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.dirs.empty())
+		{
+			node = victim.dirs.front();
+			victim.dirs.pop_front();
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+/******************************************************************************
+ * \brief Hand out the files whose place in depth-first order is settled
+ *
+ * Walk the cursor forward through directories that have been read, handing
+ * out their files and descending into their subdirectories, until it reaches
+ * a directory still to be read or the end of the tree, or the scan is
+ * stopped.  Files handed out are released from the nodes.  Must be called
+ * with cursor_lock held.
+ *****************************************************************************/
+
+void ParallelScan::advance()
+{
+	while (!cursor.empty() && cursor.back().node->done && !stopped())
+	{
+		Cursor& c = cursor.back();
+		ScanNode* node = c.node;
+		bool more = c.child < node->children.size();	//!< Subdirectory left to descend into
+		size_t end = more ? node->children[c.child].first : node->files.size();
+
+		for (; c.file < end && !stopped(); c.file++)
+			visit(node->files[c.file]);
+
+		if (c.file < end)
+			return;
+		if (more)
+		{
+			ScanNode* child = node->children[c.child++].second;
+			cursor.push_back(Cursor{ child, 0, 0 });
+		}
+		else
+		{
+			std::vector<std::string>().swap(node->files);
+			cursor.pop_back();
+		}
+	}
+}
+
+/******************************************************************************
+ * \brief Find out if the scan must stop
+ *
+ * \return true if a thread hit an error or the caller cancelled the scan
+ *****************************************************************************/
+
+bool ParallelScan::stopped() const
+{
+	return (failed || (cancel && *cancel));
+}
+
+/******************************************************************************
+ * \brief Read directories until the whole tree has been read
+ *
+ * @param [in] self index of the thread
+ *****************************************************************************/
+
+void ParallelScan::worker(int self)
+{
+	for (;;)
+	{
+		ScanNode* node;					//!< Directory to read
+		if (stopped())
+			return;
+
+		if (next(self, node))
+		{
+			try
+			{
+				StageTimer timer(Stage::scan, node->path);
+				if (enter)
+					enter(node->path);
+				auto entry = [this, self, node](const std::string& file_name, bool subdir,
+												void* tag) {
+					if (subdir)
+					{
+						ScanNode* child = add(file_name, tag);
+						node->children.emplace_back(node->files.size(), child);
+						push(self, child);
+					}
+					else
+					{
+						node->files.push_back(file_name);
+					}
+				};
+				if (lister)
+				{
+					lister->list(node->path, node->tag, entry);
+				}
+				else
+				{
+					read_dir(node->path, [this, &entry](const std::string& file_name, bool subdir) {
+						if (subdir || !filter || filter(file_name))
+							entry(file_name, subdir, nullptr);
+					});
+				}
+			}
+			catch (std::string& str)
+			{
+				std::lock_guard<std::mutex> guard(idle_lock);
+				if (!failed)
+					error = str;
+				failed = true;
+			}
+
+			if (node == root && first_batch && !failed)
+			{
+				size_t n = node->children.empty() ? node->files.size() : node->children[0].first;
+				first_batch(std::vector<std::string>(node->files.begin(), node->files.begin() + n));
+			}
+
+			{
+				std::lock_guard<std::mutex> guard(cursor_lock);
+				node->done = true;
+				advance();
+			}
+
+			if (--pending == 0 || failed)
+				idle.notify_all();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard(idle_lock);
+		if (pending == 0 || stopped())
+			return;
+		idle.wait_for(guard, std::chrono::milliseconds(1));
+	}
+}
+
+/******************************************************************************
+ * \brief Read the whole tree
+ *
+ * Throws the first error hit by any thread, once all threads have stopped.
+ *
+ * @param [in] dirname name of the root directory
+ * @param [in] first_batch function called once the root directory is read,
+ *             or nullptr
+ * @param [in] tag tag of the root directory for the lister
+ *****************************************************************************/
+
+void ParallelScan::run(const std::string& dirname,
+					   const std::function<void(const std::vector<std::string>&)>& first_batch,
+					   void* tag)
+{
+	this->first_batch = first_batch;
+
+	root = add(dirname, tag);
+	cursor.push_back(Cursor{ root, 0, 0 });
+	push(0, root);
+
+	std::vector<std::thread> threads;		//!< Scanning threads
+	for (int t = 1; t < nthreads; t++)
+		threads.emplace_back(&ParallelScan::worker, this, t);
+	worker(0);
+	for (auto& t : threads)
+		t.join();
+
+	if (failed)
+		throw (error);
+}
+
+}
+
+/******************************************************************************
+ * \brief Visit the files in directory using several threads
+ *
+ * Scan the directory tree as scan_dir() does, but read the subdirectories in
+ * parallel.  The files are visited in exactly the depth-first order of
+ * scan_dir(), each as soon as all the directories before it in that order
+ * have been read, so the first files are visited long before the whole tree
+ * has been read.  visit is called from the scanning threads, one call at a
+ * time.  If filter is given, it is called from the scanning threads, in
+ * parallel, on each file as its directory is read, and only the files it
+ * accepts are visited.  If enter is given, it is called from the scanning
+ * threads, in parallel, with each directory before it is read, so that a
+ * watch set up then misses no file the scan does not see.  Throws an
+ * exception if any directory cannot be opened.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in] visit function called with the name of each file
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ * @param [in] filter function telling which files to visit, or nullptr
+ * @param [in] cancel flag the caller may set from another thread to stop the
+ *             scan early, or NULL
+ * @param [in] enter function called with each directory before it is read,
+ *             or nullptr
+ * \sa scan_dir()
+ *****************************************************************************/
+
+void parallel_scan(const std::string& dirname,
+				   const std::function<void(const std::string&)>& visit,
+				   int nthreads, const std::function<bool(const std::string&)>& filter,
+				   const std::atomic<bool>* cancel,
+				   const std::function<void(const std::string&)>& enter)
+{
+	if (nthreads <= 0)
+		nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+	ParallelScan scan(nthreads, visit, filter, cancel, nullptr, enter);
+	scan.run(dirname, nullptr);
+}
+
+/******************************************************************************
+ * \brief Visit the files in directory using several threads and a lister
+ *
+ * Scan the directory tree as parallel_scan() above does, but take the
+ * entries of each directory from the lister rather than reading it.
+ * Throws an exception if the lister fails on any directory.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in] visit function called with the name of each file
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ * @param [in] lister source of the entries of each directory
+ * @param [in] tag tag of the root directory for the lister
+ * @param [in] cancel flag the caller may set from another thread to stop the
+ *             scan early, or NULL
+ * @param [in] enter function called with each directory before it is
+ *             listed, or nullptr
+ * \sa DirLister
+ *****************************************************************************/
+
+void parallel_scan(const std::string& dirname,
+				   const std::function<void(const std::string&)>& visit,
+				   int nthreads, DirLister& lister, void* tag,
+				   const std::atomic<bool>* cancel,
+				   const std::function<void(const std::string&)>& enter)
+{
+	if (nthreads <= 0)
+		nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+	ParallelScan scan(nthreads, visit, nullptr, cancel, &lister, enter);
+	scan.run(dirname, nullptr, tag);
+}
+
+/******************************************************************************
+ * \brief Append the files in directory to a list using several threads
+ *
+ * Scan the directory tree as parallel_scan() above does, and append the files
+ * to the list.  In dfs order, the list is exactly the one scan_dir()
+ * produces; in sorted order, it is sorted by path name.  If first_batch is
+ * given, it is called from one of the scanning threads as soon as the root
+ * directory has been read, with the files of the root directory that come
+ * before its first subdirectory; in dfs order, those are the first files of
+ * the final list.  Throws an exception if any directory cannot be opened.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in,out] files list of files to append to
+ * @param [in] order order of the files in the list
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ * @param [in] first_batch function called with the first files found, or
+ *             nullptr
+ * \sa scan_dir()
+ *****************************************************************************/
+
+void parallel_scan(const std::string& dirname, std::vector<std::string>& files,
+				   ScanOrder order, int nthreads,
+				   const std::function<void(const std::vector<std::string>&)>& first_batch)
+{
+	if (nthreads <= 0)
+		nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+	size_t first = files.size();		//!< Position of the first file appended
+
+	ParallelScan scan(nthreads, [&files](const std::string& file_name) {
+		files.push_back(file_name);
+	}, nullptr, nullptr);
+	scan.run(dirname, first_batch);
+
+	if (order == ScanOrder::sorted)
+		std::sort(files.begin() + first, files.end());
+}
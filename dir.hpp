@@ -1,7 +1,62 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <iosfwd>
+
 #ifdef __linux__
 bool is_directory(const std::string& filename);
 #endif
 
+//!< Order of the files produced by parallel_scan()
+enum class ScanOrder { dfs, sorted };
+
+//!< Order of the files listed by BackgroundScan
+enum class SortKey { none, name, natural, mtime, size, exif_date };
+
+/******************************************************************************
+ * \brief Source of the entries of the directories read by parallel_scan()
+ *
+ * By default, parallel_scan() reads every directory and runs the filter on
+ * every file.  A lister may give the entries of a directory another way, for
+ * example from an index of the tree kept from an earlier scan.  Each
+ * directory is handed to list() with the tag given for it: the root with the
+ * tag given to parallel_scan(), and every other directory with the tag its
+ * parent gave when listing it.  list() calls entry with each subdirectory and
+ * each file to visit, in the order the directory lists them.  list() is
+ * called from the scanning threads in parallel, one call per directory, and
+ * throws an exception if the directory cannot be read.
+ *****************************************************************************/
+
+class DirLister
+{
+public:
+	typedef std::function<void(const std::string&, bool, void*)> Entry;	//!< Called with the
+										//   name of an entry, true if it is a directory, and its tag
+
+	virtual ~DirLister() {}
+	virtual void list(const std::string& dirname, void* tag, const Entry& entry) = 0;
+};
+
+void read_dir(const std::string& dirname,
+			  const std::function<void(const std::string&, bool)>& entry);
+void scan_dir(const std::string& dirname, const std::function<void(const std::string&)>& visit);
+void scan_dir(const std::string& dirname, std::vector<std::string>& files);
+void parallel_scan(const std::string& dirname,
+				   const std::function<void(const std::string&)>& visit,
+				   int nthreads,
+				   const std::function<bool(const std::string&)>& filter = nullptr,
+				   const std::atomic<bool>* cancel = nullptr,
+				   const std::function<void(const std::string&)>& enter = nullptr);
+void parallel_scan(const std::string& dirname,
+				   const std::function<void(const std::string&)>& visit,
+				   int nthreads, DirLister& lister, void* tag,
+				   const std::atomic<bool>* cancel = nullptr,
+				   const std::function<void(const std::string&)>& enter = nullptr);
+void parallel_scan(const std::string& dirname, std::vector<std::string>& files,
+				   ScanOrder order, int nthreads,
+				   const std::function<void(const std::vector<std::string>&)>& first_batch = nullptr);
+void make_dirs(const std::string& dir);
+bool replace_file(const std::string& path, const std::function<void(std::ostream&)>& write);
+bool in_tree(const std::string& path, const std::string& top);
 std::vector<std::string> file_list(const std::string& dirname, std::vector<std::string>& files);
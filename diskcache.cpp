@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "frame.hpp"
+#include "diskcache.hpp"
+#include "dir.hpp"
+
+#ifdef _WIN32
+#include <stdlib.h>
+#include <sys/utime.h>
+#else
+#include <limits.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+static const char magic[4] = { 'I', 'B', 'C', '2' };	//!< Identifies a cache file
+static const int quality = 90;		//!< JPEG quality of the stored previews
+static const time_t touch_every = 24 * 60 * 60;	//!< Seconds between updates of the time of a file read
+
+/******************************************************************************
+ * \brief Hash a string with 64-bit FNV-1a
+ *
+ * @param [in] s string to hash
+ * \return hash value
+ *****************************************************************************/
+
+static uint64_t fnv1a(const std::string& s)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (unsigned char c : s)
+	{
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	return (h);
+}
+
+/******************************************************************************
+ * \brief Mark a cache file as just used
+ *
+ * Trimming removes the files with the oldest modification times first, so a
+ * file read from the cache is given the current time.  Most files are read
+ * many times in a row while browsing, so the time is only updated once a day,
+ * which is as close as trimming needs.
+ *
+ * @param [in] file name of the cache file
+ *****************************************************************************/
+
+static void touch(const std::string& file)
+{
+	struct stat buf;
+	if (stat(file.c_str(), &buf) != 0 || buf.st_mtime + touch_every > time(NULL))
+		return;
+#ifdef _WIN32
+	_utime(file.c_str(), NULL);
+#else
+	utime(file.c_str(), NULL);
+#endif
+}
+
+/******************************************************************************
+ * \brief Open a cache in the specified directory
+ *
+ * The directory is created if it does not exist.  If the cache is capped,
+ * the oldest files are removed in background to bring it under the cap; the
+ * files written while browsing count toward the cap on the next run.
+ *
+ * @param [in] dir directory holding the cache files
+ * @param [in] limit most bytes of the cache files, or 0 for no limit
+ *****************************************************************************/
+
+DiskCache::DiskCache(const std::string& dir, uint64_t limit) :
+	dir(dir),
+	stop(false)
+{
+	make_dirs(dir);
+	if (limit)
+		trimmer = std::thread(&DiskCache::trim, this, limit);
+}
+
+/******************************************************************************
+ * \brief Close the cache
+ *
+ * Trimming stops after the file it is removing.
+ *****************************************************************************/
+
+DiskCache::~DiskCache()
+{
+	stop = true;
+	if (trimmer.joinable())
+		trimmer.join();
+}
+
+/******************************************************************************
+ * \brief Remove the oldest cache files until the cache fits in its cap
+ *
+ * Only the 256 subdirectories holding the previews are read, so that indexes
+ * and other files kept in the same directory are left alone, and so are the
+ * temporary files still being written.  Files are ordered by modification
+ * time, which get() updates when it reads a file, so the previews not viewed
+ * for long go first, and with them the previews of files changed since they
+ * were cached, which are never read again.
+ *
+ * @param [in] limit most bytes of the cache files
+ *****************************************************************************/
+
+void DiskCache::trim(uint64_t limit)
+{
+	struct File
+	{
+		int64_t mtime;			//!< Modification time of the file
+		uint64_t size;			//!< Size of the file in bytes
+		std::string path;		//!< Name of the file
+	};
+	std::vector<File> files;	//!< Cache files found
+	uint64_t total = 0;			//!< Bytes of the cache files
+	std::vector<std::string> subdirs;	//!< Subdirectories holding the previews
+
+	try
+	{
+		read_dir(dir, [&](const std::string& sub, bool is_dir) {
+			std::string name = sub.substr(sub.find_last_of("/\\") + 1);
+			if (is_dir && name.size() == 2 && isxdigit(static_cast<unsigned char>(name[0])) &&
+				isxdigit(static_cast<unsigned char>(name[1])))
+				subdirs.push_back(sub);
+		});
+	}
+	catch (const std::string&)
+	{
+		return;
+	}
+
+	for (const std::string& sub : subdirs)
+	{
+		if (stop)
+			return;
+		try
+		{
+			read_dir(sub, [&](const std::string& path, bool is_dir) {
+				struct stat buf;
+				size_t name = path.find_last_of("/\\") + 1;	//!< Start of the file name
+				if (is_dir || path.find(".tmp", name) != std::string::npos ||
+					stat(path.c_str(), &buf) != 0)
+					return;
+				files.push_back({ static_cast<int64_t>(buf.st_mtime),
+								  static_cast<uint64_t>(buf.st_size), path });
+				total += static_cast<uint64_t>(buf.st_size);
+			});
+		}
+		catch (const std::string&)
+		{
+			// The subdirectory was removed since; its files are gone too
+		}
+	}
+	if (total <= limit)
+		return;
+
+	std::sort(files.begin(), files.end(), [](const File& a, const File& b) {
+		return (a.mtime < b.mtime);
+	});
+	for (const File& file : files)
+	{
+		if (total <= limit || stop)
+			break;
+		if (remove(file.path.c_str()) == 0)
+			total -= file.size;
+	}
+}
+
+/******************************************************************************
+ * \brief Find the default cache directory
+ *
+ * In Windows, the cache lives under %LOCALAPPDATA%.  In Linux and Apple, it
+ * lives under $XDG_CACHE_HOME, or under ~/.cache if that is not set.
+ *
+ * \return name of the default cache directory, or empty string if there is
+ *         no home directory
+ *****************************************************************************/
+
+std::string DiskCache::default_dir()
+{
+#ifdef _WIN32
+	const char* base = getenv("LOCALAPPDATA");
+	if (base && *base)
+		return (std::string(base) + "\\image_browser");
+#else
+	const char* base = getenv("XDG_CACHE_HOME");
+	if (base && *base)
+		return (std::string(base) + "/image_browser");
+	const char* home = getenv("HOME");
+	if (home && *home)
+		return (std::string(home) + "/.cache/image_browser");
+#endif
+	return (std::string());
+}
+
+/******************************************************************************
+ * \brief Find the default name of the index of a directory tree
+ *
+ * Indexes live in the index subdirectory of the default cache directory, one
+ * per tree, named after a hash of the absolute name of the top directory.
+ *
+ * @param [in] dirname name of the top directory of the tree
+ * \return name of the index file, or empty string if there is no default
+ *         cache directory or the directory does not exist
+ *****************************************************************************/
+
+std::string DiskCache::index_file(const std::string& dirname)
+{
+	std::string base = default_dir();
+	if (base.empty())
+		return (base);
+
+#ifdef _WIN32
+	char full[_MAX_PATH];
+	if (_fullpath(full, dirname.c_str(), sizeof(full)) == NULL)
+		return (std::string());
+#else
+	char full[PATH_MAX];
+	if (realpath(dirname.c_str(), full) == NULL)
+		return (std::string());
+#endif
+
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(fnv1a(full)));
+
+#ifdef _WIN32
+	return (base + "\\index\\" + hex + ".idx");
+#else
+	return (base + "/index/" + hex + ".idx");
+#endif
+}
+
+/******************************************************************************
+ * \brief Build the key for a file
+ *
+ * The key combines the absolute name of the file, its size and modification
+ * time, and the size of the display window.  If the file cannot be stat'ed,
+ * an empty key is returned and the file is never cached.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return key for the file, or empty string
+ *****************************************************************************/
+
+std::string DiskCache::key(const std::string& path, int maxrows, int maxcols) const
+{
+	struct stat buf;
+	if (stat(path.c_str(), &buf) != 0)
+		return (std::string());
+
+#ifdef _WIN32
+	char full[_MAX_PATH];
+	if (_fullpath(full, path.c_str(), sizeof(full)) == NULL)
+		return (std::string());
+#else
+	char full[PATH_MAX];
+	if (realpath(path.c_str(), full) == NULL)
+		return (std::string());
+#endif
+
+	std::ostringstream k;
+	k << full << "|" << static_cast<long long>(buf.st_size) << "|"
+	  << static_cast<long long>(buf.st_mtime) << "|" << maxcols << "x" << maxrows;
+	return (k.str());
+}
+
+/******************************************************************************
+ * \brief Find the name of the cache file for a key
+ *
+ * Cache files are spread across 256 subdirectories by the first byte of the
+ * hash of the key.
+ *
+ * @param [in] key key for the file
+ * \return name of the cache file
+ *****************************************************************************/
+
+std::string DiskCache::entry(const std::string& key) const
+{
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(fnv1a(key)));
+
+#ifdef _WIN32
+	return (dir + "\\" + std::string(hex, 2) + "\\" + std::string(hex + 2));
+#else
+	return (dir + "/" + std::string(hex, 2) + "/" + std::string(hex + 2));
+#endif
+}
+
+/******************************************************************************
+ * \brief Look up a frame in the cache
+ *
+ * A cache file holds the magic number, the length of the key and the key,
+ * the resolution of the original image, its content and perceptual hashes,
+ * and the preview encoded as JPEG.  A resolution of 0x0 with no preview
+ * records a file that is not an image.  The cache file found is marked as
+ * used, so that trimming keeps it.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [out] frame frame found in the cache
+ * \return true if the frame was found, false otherwise
+ *****************************************************************************/
+
+bool DiskCache::get(const std::string& path, int maxrows, int maxcols, Frame& frame)
+{
+	std::string k = key(path, maxrows, maxcols);
+	if (k.empty())
+		return (false);
+
+	std::string name = entry(k);	//!< Name of the cache file
+	std::ifstream in(name, std::ios::binary);
+	if (!in)
+		return (false);
+
+	std::vector<uchar> data((std::istreambuf_iterator<char>(in)),
+							std::istreambuf_iterator<char>());
+
+	// Check the header
+
+	size_t pos = sizeof(magic) + 4;
+	if (data.size() < pos || !std::equal(magic, magic + sizeof(magic), data.begin()))
+		return (false);
+
+	uint32_t length;
+	memcpy(&length, &data[sizeof(magic)], 4);
+	if (data.size() < pos + length + 24 ||
+		std::string(reinterpret_cast<char*>(&data[pos]), length) != k)
+		return (false);
+	pos += length;
+
+	uint32_t size[2];			//!< Columns and rows of the original image
+	memcpy(size, &data[pos], 8);
+	pos += 8;
+	uint64_t hashes[2];			//!< Content and perceptual hashes
+	memcpy(hashes, &data[pos], 16);
+	pos += 16;
+
+	frame = Frame();
+	frame.digest = hashes[0];
+	frame.dhash = hashes[1];
+	frame.read = true;
+	if (size[0] == 0)
+	{
+		touch(name);
+		return (true);
+	}
+
+	cv::Mat encoded(1, static_cast<int>(data.size() - pos), CV_8UC1, &data[pos]);
+	frame.image = cv::imdecode(encoded, cv::IMREAD_COLOR);
+	if (frame.image.empty())
+		return (false);
+	frame.cols = static_cast<int>(size[0]);
+	frame.rows = static_cast<int>(size[1]);
+	touch(name);
+
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Add a frame to the cache
+ *
+ * The cache file is written under a temporary name and renamed into place,
+ * so that a run interrupted while writing, or two runs writing the same file,
+ * never leave a partial cache file behind.  A frame with no image is cached
+ * only if the file was read and did not decode, since a file that could not
+ * be opened or mapped may well hold an image the next time.  Errors are
+ * ignored; the frame is simply not cached.
+ *
+ * @param [in] path name of the file
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [in] frame frame to be cached
+ *****************************************************************************/
+
+void DiskCache::put(const std::string& path, int maxrows, int maxcols, const Frame& frame)
+{
+	if (frame.image.empty() && !frame.read)
+		return;
+	std::string k = key(path, maxrows, maxcols);
+	if (k.empty())
+		return;
+
+	std::vector<uchar> encoded;		//!< Preview encoded as JPEG
+	uint32_t size[2] = { 0, 0 };	//!< Columns and rows of the original image
+
+	if (!frame.image.empty())
+	{
+		std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, quality };
+		if (!cv::imencode(".jpg", frame.image, encoded, params))
+			return;
+		size[0] = static_cast<uint32_t>(frame.cols);
+		size[1] = static_cast<uint32_t>(frame.rows);
+	}
+
+	uint32_t length = static_cast<uint32_t>(k.size());
+	uint64_t hashes[2] = { frame.digest, frame.dhash };
+	replace_file(entry(k), [&](std::ostream& out) {
+		out.write(magic, sizeof(magic));
+		out.write(reinterpret_cast<const char*>(&length), 4);
+		out.write(k.data(), k.size());
+		out.write(reinterpret_cast<const char*>(size), 8);
+		out.write(reinterpret_cast<const char*>(hashes), 16);
+		out.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+	});
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+/******************************************************************************
+ * \brief Persistent cache of frames ready for display
+ *
+ * The disk cache keeps the frames scaled to fit the display window in a
+ * directory that survives from one run to the next, so that browsing a
+ * directory seen before reads small previews instead of decoding the original
+ * images.  Each frame is stored in its own file named after a hash of the
+ * absolute file name, its size and modification time, and the window size;
+ * the full key is stored in the file as well to reject hash collisions.
+ * Files found not to contain an image are recorded too, so that they are not
+ * decoded again.  The cache may be capped in size, in which case the oldest
+ * files are removed in background when it is opened, which also drops the
+ * previews of files changed since.  All functions can be called from any
+ * thread.
+ *****************************************************************************/
+
+class DiskCache
+{
+public:
+	explicit DiskCache(const std::string& dir, uint64_t limit = 0);
+	~DiskCache();
+	DiskCache(const DiskCache&) = delete;
+	DiskCache& operator=(const DiskCache&) = delete;
+
+	bool get(const std::string& path, int maxrows, int maxcols, Frame& frame);
+	void put(const std::string& path, int maxrows, int maxcols, const Frame& frame);
+
+	static std::string default_dir();
+	static std::string index_file(const std::string& dirname);
+
+private:
+	std::string key(const std::string& path, int maxrows, int maxcols) const;
+	std::string entry(const std::string& key) const;
+	void trim(uint64_t limit);
+
+	std::string dir;			//!< Directory holding the cache files
+	std::atomic<bool> stop;		//!< Tells the trimming thread to stop
+	std::thread trimmer;		//!< Thread removing the oldest files
+};
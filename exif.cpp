@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "exif.hpp"
+
+namespace {
+
+/******************************************************************************
+ * \brief Reader of a TIFF structure held in memory
+ *
+ * EXIF and MPF data are laid out as a TIFF file: a header giving the byte
+ * order and the offset of the first IFD, and IFDs of 12-byte entries.  All
+ * offsets are from the start of the TIFF header.  Every read is checked
+ * against the end of the data, since the data come from untrusted files.
+ *****************************************************************************/
+
+class Tiff
+{
+public:
+	Tiff(const unsigned char* base, size_t size) : base(base), size(size) {}
+
+	bool header(size_t& ifd);
+	bool u16(size_t off, unsigned& v) const;
+	bool u32(size_t off, size_t& v) const;
+	bool ascii(size_t entry, std::string& v) const;
+
+	const unsigned char* base;	//!< Start of the TIFF header
+	size_t size;				//!< Number of bytes from base to the end of the segment
+
+private:
+	bool big = false;			//!< Set for Motorola (big-endian) byte order
+};
+
+/******************************************************************************
+ * \brief Read the TIFF header
+ *
+ * @param [out] ifd offset of the first IFD
+ * \return true if the header is valid
+ *****************************************************************************/
+
+bool Tiff::header(size_t& ifd)
+{
+	if (size < 8)
+		return (false);
+	if (memcmp(base, "MM", 2) == 0)
+		big = true;
+	else if (memcmp(base, "II", 2) != 0)
+		return (false);
+
+	unsigned magic;
+	return (u16(2, magic) && magic == 42 && u32(4, ifd));
+}
+
+/******************************************************************************
+ * \brief Read a 16-bit value
+ *
+ * @param [in] off offset of the value
+ * @param [out] v value read
+ * \return true if the value lies within the data
+ *****************************************************************************/
+
+bool Tiff::u16(size_t off, unsigned& v) const
+{
+	if (off > size || size - off < 2)
+		return (false);
+	const unsigned char* p = base + off;
+	v = big ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Read a 32-bit value
+ *
+ * @param [in] off offset of the value
+ * @param [out] v value read
+ * \return true if the value lies within the data
+ *****************************************************************************/
+
+bool Tiff::u32(size_t off, size_t& v) const
+{
+	if (off > size || size - off < 4)
+		return (false);
+	const unsigned char* p = base + off;
+	v = big ? (static_cast<size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+			: (static_cast<size_t>(p[3]) << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Read the string value of an IFD entry
+ *
+ * Strings of up to four bytes are held in the entry itself, and longer ones
+ * at the offset it gives.  Trailing NUL characters are removed.
+ *
+ * @param [in] entry offset of the IFD entry
+ * @param [out] v value read
+ * \return true if the value lies within the data
+ *****************************************************************************/
+
+bool Tiff::ascii(size_t entry, std::string& v) const
+{
+	size_t count, off = entry + 8;
+	if (!u32(entry + 4, count) || (count > 4 && !u32(entry + 8, off)))
+		return (false);
+	if (off > size || size - off < count)
+		return (false);
+	v.assign(reinterpret_cast<const char*>(base + off), count);
+	while (!v.empty() && v.back() == '\0')
+		v.pop_back();
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Record a preview if it lies within the file and is a JPEG image
+ *
+ * @param [in] data contents of the file
+ * @param [in] n size of the file
+ * @param [in] start position of the preview in the file
+ * @param [in] length size of the preview
+ * @param [in,out] info information to add the preview to
+ *****************************************************************************/
+
+void add_preview(const unsigned char* data, size_t n, size_t start, size_t length,
+				 ExifInfo& info)
+{
+	if (start >= n || length < 4 || n - start < length)
+		return;
+	if (data[start] != 0xFF || data[start + 1] != 0xD8)
+		return;
+	info.previews.push_back(Preview{ start, length });
+}
+
+/******************************************************************************
+ * \brief Parse the EXIF data of an APP1 segment
+ *
+ * IFD0 holds the orientation of the main image and the pointer to the EXIF
+ * IFD, which holds the date the picture was taken, and IFD1, which follows
+ * it, the thumbnail as a JPEG image.  The date the file was last changed in
+ * IFD0 stands in for the date taken if that is missing.
+ *
+ * @param [in] data contents of the file
+ * @param [in] n size of the file
+ * @param [in] tiff the EXIF data
+ * @param [in,out] info information to fill in
+ *****************************************************************************/
+
+void parse_exif(const unsigned char* data, size_t n, Tiff& tiff, ExifInfo& info)
+{
+	size_t ifd;
+	unsigned count;
+	if (!tiff.header(ifd) || !tiff.u16(ifd, count))
+		return;
+
+	size_t exif = 0;				//!< Offset of the EXIF IFD
+	for (unsigned e = 0; e < count; e++)
+	{
+		unsigned tag, value;
+		size_t entry = ifd + 2 + 12 * e;
+		if (!tiff.u16(entry, tag))
+			continue;
+		if (tag == 0x0112 && tiff.u16(entry + 8, value) && value >= 1 && value <= 8)
+			info.orientation = static_cast<int>(value);
+		else if (tag == 0x0132)
+			tiff.ascii(entry, info.date);
+		else if (tag == 0x8769)
+			tiff.u32(entry + 8, exif);
+	}
+
+	unsigned nexif;
+	if (exif && tiff.u16(exif, nexif))
+	{
+		for (unsigned e = 0; e < nexif; e++)
+		{
+			unsigned tag;
+			size_t entry = exif + 2 + 12 * e;
+			if (tiff.u16(entry, tag) && tag == 0x9003)
+				tiff.ascii(entry, info.date);
+		}
+	}
+
+	size_t ifd1;
+	if (!tiff.u32(ifd + 2 + 12 * count, ifd1) || ifd1 == 0 || !tiff.u16(ifd1, count))
+		return;
+
+	size_t offset = 0, length = 0;	//!< Position and size of the thumbnail
+	for (unsigned e = 0; e < count; e++)
+	{
+		unsigned tag;
+		size_t entry = ifd1 + 2 + 12 * e;
+		if (!tiff.u16(entry, tag))
+			return;
+		if (tag == 0x0201)
+			tiff.u32(entry + 8, offset);
+		else if (tag == 0x0202)
+			tiff.u32(entry + 8, length);
+	}
+
+	if (offset && length)
+		add_preview(data, n, static_cast<size_t>(tiff.base - data) + offset, length, info);
+}
+
+/******************************************************************************
+ * \brief Parse the Multi-Picture Format data of an APP2 segment
+ *
+ * The MP Index IFD lists every image in the file, the main image first with
+ * offset 0.  The others are previews, often at display resolution, with
+ * offsets from the start of the MPF data.
+ *
+ * @param [in] data contents of the file
+ * @param [in] n size of the file
+ * @param [in] tiff the MPF data
+ * @param [in,out] info information to fill in
+ *****************************************************************************/
+
+void parse_mpf(const unsigned char* data, size_t n, Tiff& tiff, ExifInfo& info)
+{
+	size_t ifd;
+	unsigned count;
+	if (!tiff.header(ifd) || !tiff.u16(ifd, count))
+		return;
+
+	for (unsigned e = 0; e < count; e++)
+	{
+		unsigned tag;
+		size_t entry = ifd + 2 + 12 * e;
+		size_t size, where;			//!< Size and offset of the MP entries
+		if (!tiff.u16(entry, tag) || tag != 0xB002 ||
+			!tiff.u32(entry + 4, size) || !tiff.u32(entry + 8, where))
+			continue;
+
+		for (size_t m = 0; m + 16 <= size; m += 16)
+		{
+			size_t length, offset;
+			if (!tiff.u32(where + m + 4, length) || !tiff.u32(where + m + 8, offset))
+				break;
+			if (offset != 0)
+				add_preview(data, n, static_cast<size_t>(tiff.base - data) + offset, length, info);
+		}
+	}
+}
+
+}
+
+/******************************************************************************
+ * \brief Find the orientation, the date, and the embedded previews of a JPEG file
+ *
+ * Walk the segments in front of the first frame header, parsing the EXIF
+ * APP1 segment and the MPF APP2 segment where present.  Previews are checked
+ * to lie within the file and to start like a JPEG image, but are not decoded.
+ *
+ * @param [in] data contents of the file
+ * @param [in] n size of the file
+ * @param [out] info orientation, date, and previews found
+ * \return true if the file is a JPEG file, false otherwise
+ *****************************************************************************/
+
+bool read_exif(const unsigned char* data, size_t n, ExifInfo& info)
+{
+	info = ExifInfo();
+	if (n < 4 || data[0] != 0xFF || data[1] != 0xD8)
+		return (false);
+
+	size_t pos = 2;				//!< Position of the next marker
+	while (pos + 4 <= n && data[pos] == 0xFF)
+	{
+		int marker = data[pos + 1];
+		size_t length = (data[pos + 2] << 8) | data[pos + 3];
+		if (marker == 0xDA || (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+							   marker != 0xC8 && marker != 0xCC) || length < 2)
+			break;				// Start of scan or frame header; no more metadata
+
+		const unsigned char* body = data + pos + 4;
+		size_t size = std::min(length - 2, n - (pos + 4));
+
+		if (marker == 0xE1 && size > 6 && memcmp(body, "Exif\0\0", 6) == 0)
+		{
+			Tiff tiff(body + 6, size - 6);
+			parse_exif(data, n, tiff, info);
+		}
+		else if (marker == 0xE2 && size > 4 && memcmp(body, "MPF\0", 4) == 0)
+		{
+			// The MPF data reach past the segment, up to the previews at the
+			// end of the file.
+
+			Tiff tiff(body + 4, n - (pos + 8));
+			parse_mpf(data, n, tiff, info);
+		}
+
+		pos += 2 + length;
+	}
+
+	return (true);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+//!< Location of a JPEG image embedded in a JPEG file
+struct Preview
+{
+	size_t offset;				//!< Position of the embedded image in the file
+	size_t length;				//!< Size of the embedded image
+};
+
+//!< Information found in the EXIF and MPF segments of a JPEG file
+struct ExifInfo
+{
+	int orientation = 1;		//!< EXIF orientation of the main image, 1 to 8
+	std::string date;			//!< Date the picture was taken, YYYY:MM:DD HH:MM:SS, or empty
+	std::vector<Preview> previews;	//!< Embedded preview images
+};
+
+bool read_exif(const unsigned char* data, size_t n, ExifInfo& info);
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "frame.hpp"
+#include "dir.hpp"
+#include "filelist.hpp"
+#include "stats.hpp"
+#include "export.hpp"
+
+#ifdef _WIN32
+#include <stdlib.h>
+#else
+#include <limits.h>
+#include <stdlib.h>
+#endif
+
+static const int quality = 90;			//!< Quality of exported JPEG and WebP images
+
+/******************************************************************************
+ * \brief Find the name of the copy of a file
+ *
+ * The copy has the same path under dest as the file has under top, with the
+ * extension of the format added to its own, so that files differing only in
+ * their extension, such as a.jpg and a.png, do not share a copy.
+ *
+ * @param [in] path name of the file
+ * @param [in] top directory being exported
+ * @param [in] dest directory to write the copies to
+ * @param [in] format file extension of the copies
+ * \return name of the copy
+ *****************************************************************************/
+
+static std::string export_name(const std::string& path, const std::string& top,
+							   const std::string& dest, const std::string& format)
+{
+	std::string rel = path.compare(0, top.size(), top) == 0 ? path.substr(top.size()) : path;
+	if (rel.empty() || (rel[0] != '/' && rel[0] != '\\'))
+		rel = "/" + rel;
+
+	return (dest + rel + "." + format);
+}
+
+/******************************************************************************
+ * \brief Find the absolute name of a file, with no links
+ *
+ * @param [in] path name of the file, which must exist
+ * \return absolute name, or the name given if it cannot be resolved
+ *****************************************************************************/
+
+static std::string full_path(const std::string& path)
+{
+#ifdef _WIN32
+	char full[_MAX_PATH];
+	if (_fullpath(full, path.c_str(), sizeof(full)) == NULL)
+		return (path);
+#else
+	char full[PATH_MAX];
+	if (realpath(path.c_str(), full) == NULL)
+		return (path);
+#endif
+	return (full);
+}
+
+/******************************************************************************
+ * \brief Find out if the copy of a file is up to date
+ *
+ * @param [in] path name of the file
+ * @param [in] out name of the copy
+ * \return true if the copy exists and is newer than the file
+ *****************************************************************************/
+
+static bool up_to_date(const std::string& path, const std::string& out)
+{
+	struct stat src, dst;
+	return (stat(out.c_str(), &dst) == 0 && stat(path.c_str(), &src) == 0 &&
+			dst.st_mtime >= src.st_mtime);
+}
+
+/******************************************************************************
+ * \brief Write scaled copies of every image to another directory
+ *
+ * Each image is decoded and scaled to fit maxrows x maxcols as for display,
+ * encoded in the format given, and written under dest with the same path it
+ * has under top.  The previews embedded in JPEG files are turned off, so that
+ * the copies are always scaled down from the main image and never enlarged
+ * from a preview.  One thread per core takes the files from the list in turn
+ * as the scan finds them and runs each through all the stages, so that the
+ * stages of different images overlap and no more than one image per thread
+ * is in memory at a time.  Images whose copy is newer than the file are
+ * skipped, so an interrupted export picks up where it stopped; copies are
+ * written whole or not at all, so a partial copy is never taken as up to
+ * date.  The number of images exported, skipped, and failed is reported at
+ * the end.  Throws an
+ * exception if the format is unknown, if dest is in the tree under top,
+ * where the copies would be exported again on the next run, or if the scan
+ * fails.
+ *
+ * @param [in] files list of files being filled by the scan
+ * @param [in] top directory being exported
+ * @param [in] dest directory to write the copies to
+ * @param [in] maxrows maximum number of rows of the copies
+ * @param [in] maxcols maximum number of columns of the copies
+ * @param [in] format format of the copies: jpg, webp, or png
+ *****************************************************************************/
+
+void run_export(FileList& files, const std::string& top, const std::string& dest,
+				int maxrows, int maxcols, const std::string& format)
+{
+	std::vector<int> params;			//!< Parameters of the encoder
+	if (format == "jpg")
+		params = { cv::IMWRITE_JPEG_QUALITY, quality };
+	else if (format == "webp")
+		params = { cv::IMWRITE_WEBP_QUALITY, quality };
+	else if (format != "png")
+		throw (std::string("Unknown export format ") + format);
+
+	make_dirs(dest);
+	if (in_tree(full_path(dest), full_path(top)))
+		throw (std::string("Cannot export ") + top + " into itself: " + dest);
+	use_previews(false);
+
+	auto start = std::chrono::steady_clock::now();	//!< Time the export was started
+	std::atomic<size_t> next(0);		//!< Index of the next file to take
+	std::atomic<size_t> written(0);		//!< Number of images exported
+	std::atomic<size_t> skipped(0);		//!< Number of images already up to date
+	std::atomic<size_t> failed(0);		//!< Number of images that could not be written
+	std::mutex print_lock;				//!< Serializes error messages
+
+	auto worker = [&]() {
+		std::vector<uchar> data;		//!< Encoded image, reused across images
+		for (size_t i; files.wait(i = next++); )
+		{
+			if (files.dropped(i))
+				continue;
+
+			std::string path = files[i];
+			std::string out = export_name(path, top, dest, format);
+			if (up_to_date(path, out))
+			{
+				skipped++;
+				continue;
+			}
+
+			Frame frame = load_frame(path, maxrows, maxcols);
+			if (frame.image.empty())
+			{
+				files.drop(i);
+				continue;
+			}
+
+			StageTimer timer(Stage::encode, path);
+			if (cv::imencode("." + format, frame.image, data, params) &&
+				replace_file(out, [&data](std::ostream& f) {
+					f.write(reinterpret_cast<const char*>(data.data()), data.size());
+				}))
+			{
+				written++;
+			}
+			else
+			{
+				failed++;
+				std::lock_guard<std::mutex> guard(print_lock);
+				std::cerr << "Cannot write " << out << std::endl;
+			}
+		}
+	};
+
+	int nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nthreads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& t : threads)
+		t.join();
+
+	if (!files.error().empty())
+		throw (files.error());
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << std::fixed << std::setprecision(2)
+			  << "exported    " << written << "\n"
+			  << "up to date  " << skipped << "\n"
+			  << "failed      " << failed << "\n"
+			  << "seconds     " << seconds << "\n"
+			  << "images/s    " << (seconds > 0 ? written / seconds : 0) << std::endl;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <string>
+
+void run_export(FileList& files, const std::string& top, const std::string& dest,
+				int maxrows, int maxcols, const std::string& format);
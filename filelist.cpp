@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "dir.hpp"
+#include "filelist.hpp"
+#include "index.hpp"
+#include "sort.hpp"
+
+/******************************************************************************
+ * \brief Find where the directory of a path ends
+ *
+ * Names too long for an entry are kept whole in the directory table, like
+ * directories, with an empty name.
+ *
+ * @param [in] path name of the file
+ * \return length of the directory part, with its separator
+ *****************************************************************************/
+
+static size_t split_path(const std::string& path)
+{
+	size_t slash = path.find_last_of("/\\");
+	size_t split = slash == std::string::npos ? 0 : slash + 1;
+	return (path.size() - split > UINT16_MAX ? path.size() : split);
+}
+
+/******************************************************************************
+ * \brief Store a file at the end of the list
+ *
+ * Must be called with lock held.  The files of a directory mostly come one
+ * after another, so the directory of the last file is tried before the
+ * table is looked up.  Once the list is indexed, the file and its directory
+ * are indexed too.
+ *
+ * @param [in] path name of the file
+ *****************************************************************************/
+
+void FileList::append(const std::string& path)
+{
+	size_t split = split_path(path);
+
+	if (last_dir >= dirs.size() || dirs[last_dir].size() != split ||
+		path.compare(0, split, dirs[last_dir]) != 0)
+	{
+		std::string dir = path.substr(0, split);
+		auto found = dir_ids.find(dir);
+		if (found != dir_ids.end())
+		{
+			last_dir = found->second;
+		}
+		else
+		{
+			last_dir = static_cast<uint32_t>(dirs.size());
+			dir_ids.emplace(dir, last_dir);
+			dirs.push_back(dir);
+			if (indexed)
+				add_tree(dir);
+		}
+	}
+
+	if (indexed)
+		by_path.emplace(std::hash<std::string>()(path), static_cast<uint32_t>(files.size()));
+	files.push_back(Entry{ last_dir, static_cast<uint32_t>(names.size()),
+						   static_cast<uint16_t>(path.size() - split), false });
+	names.append(path, split, std::string::npos);
+}
+
+/******************************************************************************
+ * \brief Record a directory and those above it as holding files
+ *
+ * Must be called with lock held.  Stops at the first directory recorded
+ * already, since those above it are too.
+ *
+ * @param [in] dir name of the directory, with the separator at the end
+ *****************************************************************************/
+
+void FileList::add_tree(std::string dir)
+{
+	while (!dir.empty() && trees.insert(dir).second)
+	{
+		dir.pop_back();
+		size_t slash = dir.find_last_of("/\\");
+		if (slash == std::string::npos)
+			break;
+		dir.resize(slash + 1);
+	}
+}
+
+/******************************************************************************
+ * \brief Index the files and directories of the list
+ *
+ * Must be called with lock held.  Done once, on the first change from a
+ * watch; from then on, append() keeps the index up to date.
+ *****************************************************************************/
+
+void FileList::index()
+{
+	if (indexed)
+		return;
+
+	by_path.reserve(files.size());
+	for (size_t i = 0; i < files.size(); i++)
+		by_path.emplace(std::hash<std::string>()(path(files[i])), static_cast<uint32_t>(i));
+	for (const std::string& dir : dirs)
+		add_tree(dir);
+	indexed = true;
+}
+
+/******************************************************************************
+ * \brief Put together the full path of a file
+ *
+ * Must be called with lock held.
+ *
+ * @param [in] e entry of the file
+ * \return name of the file
+ *****************************************************************************/
+
+std::string FileList::path(const Entry& e) const
+{
+	const std::string& dir = dirs[e.dir];
+	std::string full;
+	full.reserve(dir.size() + e.length);
+	full.append(dir).append(names, e.offset, e.length);
+	return (full);
+}
+
+/******************************************************************************
+ * \brief Find out if an entry is the specified file
+ *
+ * Must be called with lock held.  The path is compared in place, without
+ * putting together that of the entry.
+ *
+ * @param [in] e entry of the file
+ * @param [in] path name of a file
+ * \return true if the entry is for path
+ *****************************************************************************/
+
+bool FileList::is(const Entry& e, const std::string& path) const
+{
+	const std::string& dir = dirs[e.dir];
+	return (dir.size() + e.length == path.size() && path.compare(0, dir.size(), dir) == 0 &&
+			path.compare(dir.size(), e.length, names, e.offset, e.length) == 0);
+}
+
+/******************************************************************************
+ * \brief Append a file to the list
+ *
+ * Wakes up anyone waiting for the list to grow.
+ *
+ * @param [in] file name of the file
+ *****************************************************************************/
+
+void FileList::push_back(const std::string& file)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		append(file);
+	}
+	grown.notify_all();
+}
+
+/******************************************************************************
+ * \brief Mark the list as complete
+ *
+ * No more files are added after this.  Wakes up anyone waiting for the list
+ * to grow.
+ *
+ * @param [in] error error that stopped the scan, or empty string if the scan
+ *             completed
+ *****************************************************************************/
+
+void FileList::finish(const std::string& error)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+		failure = error;
+		for (const auto& change : pending)
+			apply(change.first, change.second);
+		pending.clear();
+	}
+	grown.notify_all();
+}
+
+/******************************************************************************
+ * \brief Add a file found by a watch
+ *
+ * The file is appended unless it is in the list already.  While the scan is
+ * running, it may still find the file, so the file is added when the scan
+ * ends.  Wakes up anyone waiting for the list to grow.
+ *
+ * @param [in] file name of the file
+ *****************************************************************************/
+
+void FileList::add(const std::string& file)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (done)
+			apply(file, true);
+		else
+			pending.emplace_back(file, true);
+	}
+	grown.notify_all();
+}
+
+/******************************************************************************
+ * \brief Drop a file, or all files in a directory, removed from the disk
+ *
+ * While the scan is running, it may still list the files, so they are
+ * dropped when the scan ends.
+ *
+ * @param [in] path name of the file or directory
+ *****************************************************************************/
+
+void FileList::remove(const std::string& path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (done)
+		apply(path, false);
+	else
+		pending.emplace_back(path, false);
+}
+
+/******************************************************************************
+ * \brief Apply a change found by a watch
+ *
+ * Must be called with lock held.  A file is added unless it is listed and
+ * not dropped; a file that was dropped is added again at the end, so that
+ * the files after it keep their index.  Files are found through the index of
+ * their paths; only removing a directory that holds files goes through the
+ * whole list.
+ *
+ * @param [in] path name of the file or directory
+ * @param [in] added true if the file was added, false if path was removed
+ *****************************************************************************/
+
+void FileList::apply(const std::string& path, bool added)
+{
+	index();
+	auto range = by_path.equal_range(std::hash<std::string>()(path));	//!< Files with the
+												//   hash of path
+	if (added)
+	{
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (!files[it->second].dropped && is(files[it->second], path))
+				return;
+		}
+		append(path);
+	}
+	else if (!trees.count(path + "/") && !trees.count(path + "\\"))
+	{
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (is(files[it->second], path))
+				files[it->second].dropped = true;
+		}
+	}
+	else
+	{
+		// Find the directories in the tree removed once, rather than the
+		// directory of every file.
+
+		std::vector<bool> under(dirs.size());	//!< Set for the directories removed
+		for (size_t d = 0; d < dirs.size(); d++)
+		{
+			std::string dir = dirs[d];
+			if (!dir.empty() && (dir.back() == '/' || dir.back() == '\\'))
+				dir.pop_back();
+			under[d] = !dir.empty() && in_tree(dir, path);
+		}
+
+		for (auto& e : files)
+		{
+			if (under[e.dir] || is(e, path))
+				e.dropped = true;
+		}
+	}
+}
+
+/******************************************************************************
+ * \brief Wait for the specified entry to be in the list
+ *
+ * Block until the list holds more than i files or the scan has finished.
+ *
+ * @param [in] i index of the entry
+ * \return true if the entry exists, false if the list ended before it
+ *****************************************************************************/
+
+bool FileList::wait(size_t i) const
+{
+	std::unique_lock<std::mutex> guard(lock);
+	grown.wait(guard, [this, i]() { return (i < files.size() || done); });
+	return (i < files.size());
+}
+
+/******************************************************************************
+ * \brief Find the number of files in the list so far
+ *
+ * \return number of files
+ *****************************************************************************/
+
+size_t FileList::size() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (files.size());
+}
+
+/******************************************************************************
+ * \brief Get the name of a file
+ *
+ * A copy is returned since the list may change as soon as the lock is
+ * released.
+ *
+ * @param [in] i index of the file, less than size()
+ * \return name of the file
+ *****************************************************************************/
+
+std::string FileList::operator[](size_t i) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (path(files[i]));
+}
+
+/******************************************************************************
+ * \brief Mark a file as not an image
+ *
+ * The file stays in the list so that the files after it keep their index,
+ * but it is skipped from now on.  This takes constant time, unlike removing
+ * the file from the middle of the list.
+ *
+ * @param [in] i index of the file, less than size()
+ *****************************************************************************/
+
+void FileList::drop(size_t i)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	files[i].dropped = true;
+}
+
+/******************************************************************************
+ * \brief Find out if a file has been dropped
+ *
+ * @param [in] i index of the file, less than size()
+ * \return true if the file is not an image
+ *****************************************************************************/
+
+bool FileList::dropped(size_t i) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (files[i].dropped);
+}
+
+/******************************************************************************
+ * \brief Find the next file whose name contains the specified text
+ *
+ * Only the name of the file within its directory is searched, ignoring case,
+ * in place in the names of the list.  The search starts at from, wraps
+ * around at the end of the list, and skips the files dropped.
+ *
+ * @param [in] text text to look for
+ * @param [in] from index of the first file to look at
+ * \return index of the file found, or SIZE_MAX if there is none
+ *****************************************************************************/
+
+size_t FileList::find(const std::string& text, size_t from) const
+{
+	auto same = [](char a, char b) {
+		return (tolower(static_cast<unsigned char>(a)) == tolower(static_cast<unsigned char>(b)));
+	};
+
+	std::lock_guard<std::mutex> guard(lock);
+	size_t n = files.size();
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t j = (from + k) % n;
+		const Entry& e = files[j];
+		if (e.dropped)
+			continue;
+		auto begin = names.begin() + e.offset;
+		auto end = begin + e.length;
+		if (std::search(begin, end, text.begin(), text.end(), same) != end)
+			return (j);
+	}
+
+	return (SIZE_MAX);
+}
+
+/******************************************************************************
+ * \brief Find out if the scan has finished
+ *
+ * \return true if no more files will be added
+ *****************************************************************************/
+
+bool FileList::finished() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (done);
+}
+
+/******************************************************************************
+ * \brief Get the error that stopped the scan
+ *
+ * \return error message, or empty string if there was no error
+ *****************************************************************************/
+
+std::string FileList::error() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (failure);
+}
+
+/******************************************************************************
+ * \brief Start scanning a directory tree into a file list
+ *
+ * With no sort order, files are appended in depth-first order as the scan
+ * finds them.  Otherwise, no file can be placed until the whole tree has been
+ * read, so the files are appended all at once at the end.  Only the files
+ * accepted by filter, if given, are appended.  The tree is read by nthreads
+ * threads, and with an index file, only the directories that changed since
+ * the last scan are read.  The size and modification time that sorting
+ * needs come from the index, or else are stat'ed by the scanning threads
+ * along with the filter, so sorting never goes back over the files to stat
+ * them.  enter, if given, is called from the scanning threads with each
+ * directory before it is read.  Errors are recorded in the list.
+ *
+ * @param [in] dirname name of the directory
+ * @param [in] sort order of the files in the list
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ * @param [in,out] files list to append the files to
+ * @param [in] filter function telling which files to list, or nullptr
+ * @param [in] index name of the index file, or empty for no index
+ * @param [in] enter function called with each directory, or nullptr
+ * \sa parallel_scan(), DirIndex, sort_files()
+ *****************************************************************************/
+
+BackgroundScan::BackgroundScan(const std::string& dirname, SortKey sort, int nthreads,
+							   FileList& files,
+							   const std::function<bool(const std::string&)>& filter,
+							   const std::string& index,
+							   const std::function<void(const std::string&)>& enter) :
+	cancel(false)
+{
+	thread = std::thread([this, dirname, sort, nthreads, &files, filter, index, enter]() {
+		try
+		{
+			std::mutex meta_lock;	//!< Protects meta
+			std::unordered_map<std::string, std::pair<uint64_t, int64_t>> meta;	//!< Size and time of each file
+			std::function<void(const std::string&, uint64_t, int64_t)> record;	//!< Records meta, if needed
+			if (needs_stat(sort))
+			{
+				record = [&meta_lock, &meta](const std::string& file_name, uint64_t size,
+											 int64_t mtime) {
+					std::lock_guard<std::mutex> guard(meta_lock);
+					meta[file_name] = std::make_pair(size, mtime);
+				};
+			}
+
+			auto scan = [&](const std::function<void(const std::string&)>& visit) {
+				if (!index.empty())
+				{
+					DirIndex(index).scan(dirname, visit, nthreads, filter, &cancel, record, enter);
+				}
+				else if (record)
+				{
+					parallel_scan(dirname, visit, nthreads, [&](const std::string& file_name) {
+						if (filter && !filter(file_name))
+							return (false);
+						struct stat buf;
+						if (stat(file_name.c_str(), &buf) == 0)
+							record(file_name, static_cast<uint64_t>(buf.st_size),
+								   static_cast<int64_t>(buf.st_mtime));
+						return (true);
+					}, &cancel, enter);
+				}
+				else
+				{
+					parallel_scan(dirname, visit, nthreads, filter, &cancel, enter);
+				}
+			};
+
+			if (sort == SortKey::none)
+			{
+				scan([&files](const std::string& file_name) {
+					files.push_back(file_name);
+				});
+			}
+			else
+			{
+				std::vector<SortEntry> sorted;	//!< Files to be sorted before listing
+				scan([&sorted](const std::string& file_name) {
+					SortEntry e;
+					e.path = file_name;
+					sorted.push_back(std::move(e));
+				});
+				for (auto& e : sorted)
+				{
+					auto found = meta.find(e.path);
+					if (found != meta.end())
+					{
+						e.size = found->second.first;
+						e.mtime = found->second.second;
+					}
+				}
+				if (sort == SortKey::exif_date && !cancel)
+					read_dates(sorted, nthreads);
+				sort_files(sorted, sort);
+				for (const auto& e : sorted)
+					files.push_back(e.path);
+			}
+			files.finish();
+		}
+		catch (std::string& str)
+		{
+			files.finish(str);
+		}
+	});
+}
+
+/******************************************************************************
+ * \brief Stop the scan
+ *
+ * Cancel the scan if it is still running, and wait for it to exit.
+ *****************************************************************************/
+
+BackgroundScan::~BackgroundScan()
+{
+	cancel = true;
+	thread.join();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/******************************************************************************
+ * \brief List of files filled in by a scan running in background
+ *
+ * The scanner appends files to the list while the display loop reads from
+ * it, so that browsing can start as soon as the first file is found.  Files
+ * are only ever appended at the end, and files found not to be images are
+ * marked as dropped rather than removed, so the index of a file never
+ * changes.  Files added or removed by a watch after the scan started are
+ * applied once the scan ends, so that a file both found by the scan and
+ * added by the watch is listed once.  All functions can be called from any
+ * thread.
+ *
+ * Paths are not kept whole, since the files of a directory would each hold
+ * a copy of its name.  Each directory is stored once in a table, and the
+ * names of the files within their directories one after another in a single
+ * string, so that an entry is a few bytes on top of the name of the file and
+ * adding one seldom allocates memory.  Full paths are put together only when
+ * asked for.  The first change from a watch indexes the files by a hash of
+ * their paths, and the directories by name with all those above them, so
+ * that adding and removing a file from then on take the same time however
+ * long the list is; lists that are not watched never pay for the index.
+ *****************************************************************************/
+
+class FileList
+{
+public:
+	void push_back(const std::string& file);
+	void finish(const std::string& error = std::string());
+	void add(const std::string& file);
+	void remove(const std::string& path);
+
+	bool wait(size_t i) const;
+	size_t size() const;
+	std::string operator[](size_t i) const;
+	void drop(size_t i);
+	bool dropped(size_t i) const;
+	size_t find(const std::string& text, size_t from) const;
+
+	bool finished() const;
+	std::string error() const;
+
+private:
+	//!< File in the list
+	struct Entry
+	{
+		uint32_t dir;				//!< Directory of the file in dirs
+		uint32_t offset;			//!< Position of the name of the file in names
+		uint16_t length;			//!< Length of the name of the file
+		bool dropped;				//!< Set if the file is not an image
+	};
+
+	void append(const std::string& path);
+	std::string path(const Entry& e) const;
+	bool is(const Entry& e, const std::string& path) const;
+	void apply(const std::string& path, bool added);
+	void index();
+	void add_tree(std::string dir);
+
+	std::deque<Entry> files;		//!< Files found so far
+	std::vector<std::string> dirs;	//!< Directories of the files, with the separator at the end
+	std::unordered_map<std::string, uint32_t> dir_ids;	//!< Position of each directory in dirs
+	uint32_t last_dir = 0;			//!< Directory of the file appended last
+	std::string names;				//!< Names of the files within their directories
+	std::vector<std::pair<std::string, bool>> pending;	//!< Changes waiting for the scan to end
+	bool indexed = false;			//!< Set once the files are indexed for the watch
+	std::unordered_multimap<size_t, uint32_t> by_path;	//!< Files by hash of their path, once indexed
+	std::unordered_set<std::string> trees;	//!< Directories holding files at any depth, once indexed
+	bool done = false;				//!< Set when the scan has finished
+	std::string failure;			//!< Error that stopped the scan, if any
+	mutable std::mutex lock;		//!< Protects all of the above
+	mutable std::condition_variable grown;	//!< Signalled when files are appended or done is set
+};
+
+/******************************************************************************
+ * \brief Scan of a directory tree into a file list on a thread of its own
+ *
+ * The scan starts when the object is created.  Destroying the object cancels
+ * the scan if it is still running and waits for the scanning threads to exit.
+ *****************************************************************************/
+
+class BackgroundScan
+{
+public:
+	BackgroundScan(const std::string& dirname, SortKey sort, int nthreads, FileList& files,
+				   const std::function<bool(const std::string&)>& filter = nullptr,
+				   const std::string& index = std::string(),
+				   const std::function<void(const std::string&)>& enter = nullptr);
+	~BackgroundScan();
+
+private:
+	std::atomic<bool> cancel;		//!< Set to stop the scan early
+	std::thread thread;				//!< Thread running the scan
+};
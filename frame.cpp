@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include "frame.hpp"
+#include "exif.hpp"
+#include "hash.hpp"
+#include "header.hpp"
+#include "mapfile.hpp"
+#include "scale.hpp"
+#include "stats.hpp"
+
+static std::atomic<bool> previews(true);	//!< Set to use previews embedded in JPEG files
+static std::atomic<bool> hashes(false);		//!< Set to hash the frames loaded
+static const size_t quick_pixels = 1 << 22;	//!< Smallest image worth a quick preview
+
+/******************************************************************************
+ * \brief Choose the decode mode for an image of known size
+ *
+ * Find the largest power-of-two reduction, up to 8, that still leaves the
+ * decoded image at least as big as the image scaled to fit the window.  The
+ * image may be rotated on decode according to its EXIF orientation, so the
+ * reduction must hold for both orientations.  JPEG decoders apply the
+ * reduction while decoding, at a fraction of the cost of a full decode.
+ * Other decoders decode in full and then shrink the image with a bilinear
+ * filter, which aliases and saves nothing, so the mode is only for JPEG.
+ *
+ * @param [in] cols number of columns in the original image
+ * @param [in] rows number of rows in the original image
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return flags for cv::imdecode
+ *****************************************************************************/
+
+static int decode_mode(int cols, int rows, int maxrows, int maxcols)
+{
+	float ratio1 = std::min(static_cast<float>(maxcols) / cols,
+							static_cast<float>(maxrows) / rows);
+	float ratio2 = std::min(static_cast<float>(maxcols) / rows,
+							static_cast<float>(maxrows) / cols);
+	float ratio = std::max(ratio1, ratio2);	//!< Largest ratio the image may be scaled by
+
+	if (ratio * 8 <= 1.0f)
+		return (cv::IMREAD_REDUCED_COLOR_8);
+	if (ratio * 4 <= 1.0f)
+		return (cv::IMREAD_REDUCED_COLOR_4);
+	if (ratio * 2 <= 1.0f)
+		return (cv::IMREAD_REDUCED_COLOR_2);
+	return (cv::IMREAD_COLOR);
+}
+
+/******************************************************************************
+ * \brief Find out if a file is a JPEG file
+ *
+ * @param [in] data contents of the file
+ * @param [in] n number of bytes in the file
+ * \return true if the file starts with a JPEG start of image marker
+ *****************************************************************************/
+
+static bool is_jpeg(const unsigned char* data, size_t n)
+{
+	return (n >= 2 && data[0] == 0xFF && data[1] == 0xD8);
+}
+
+/******************************************************************************
+ * \brief Turn an image as its EXIF orientation says
+ *
+ * Decoders apply the orientation of a JPEG file to its main image, but the
+ * previews embedded in it carry no orientation of their own, so the one of
+ * the main image is applied here the same way.
+ *
+ * @param [in,out] img image to turn
+ * @param [in] orientation EXIF orientation, 1 to 8
+ *****************************************************************************/
+
+static void orient(cv::Mat& img, int orientation)
+{
+	switch (orientation)
+	{
+		case 2: cv::flip(img, img, 1); break;
+		case 3: cv::flip(img, img, -1); break;
+		case 4: cv::flip(img, img, 0); break;
+		case 5: cv::transpose(img, img); break;
+		case 6: cv::transpose(img, img); cv::flip(img, img, 1); break;
+		case 7: cv::transpose(img, img); cv::flip(img, img, -1); break;
+		case 8: cv::transpose(img, img); cv::flip(img, img, 0); break;
+	}
+}
+
+/******************************************************************************
+ * \brief Find out if a preview has the same shape as the main image
+ *
+ * @param [in] pcols number of columns in the preview
+ * @param [in] prows number of rows in the preview
+ * @param [in] cols number of columns in the main image
+ * @param [in] rows number of rows in the main image
+ * \return true if the aspect ratios differ by no more than 2%
+ *****************************************************************************/
+
+static bool same_shape(int pcols, int prows, int cols, int rows)
+{
+	static const float max_skew = 0.02f;	//!< Most a preview may differ in shape
+
+	return (std::abs(static_cast<float>(pcols) * rows - static_cast<float>(prows) * cols) <=
+			max_skew * prows * cols);
+}
+
+/******************************************************************************
+ * \brief Prepare a frame from a preview embedded in a JPEG file
+ *
+ * Cameras embed a thumbnail in the EXIF data, and often a preview at about
+ * display resolution in MPF data, and decoding those is far cheaper than
+ * decoding the main image.  Of the previews with the same shape as the main
+ * image, take the smallest one that needs to be enlarged by no more than
+ * max_stretch to fill the window.  If there is none, return false so that
+ * the main image is decoded instead.
+ *
+ * @param [in] path name of the JPEG file
+ * @param [in] file contents of the JPEG file
+ * @param [in] cols number of columns in the main image, before orientation
+ * @param [in] rows number of rows in the main image, before orientation
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [out] frame frame ready to be displayed
+ * \return true if a preview was used, false otherwise
+ *****************************************************************************/
+
+static bool load_preview(const std::string& path, const MappedFile& file, int cols, int rows,
+						 int maxrows, int maxcols, Frame& frame)
+{
+	static const float max_stretch = 1.25f;	//!< Most a preview may be enlarged by
+
+	ExifInfo info;
+	if (!read_exif(file.data(), file.size(), info) || info.previews.empty())
+		return (false);
+
+	// Find the size of the image as displayed, and the width the preview
+	// needs to have before it is turned.
+
+	bool turned = info.orientation >= 5;
+	int ocols = turned ? rows : cols;
+	int orows = turned ? cols : rows;
+	float ratio = std::min(static_cast<float>(maxcols) / ocols,
+						   static_cast<float>(maxrows) / orows);
+	float need = ratio * cols;	//!< Width of the preview needed
+
+	const Preview* best = nullptr;	//!< Preview picked so far
+	int best_cols = 0, best_rows = 0;	//!< Size of the preview picked
+	for (const auto& p : info.previews)
+	{
+		int pcols, prows;
+		if (!image_size(file.data() + p.offset, p.length, pcols, prows))
+			continue;
+		if (!same_shape(pcols, prows, cols, rows))
+			continue;
+		if (pcols * max_stretch < need)
+			continue;
+		if (!best || pcols < best_cols)
+		{
+			best = &p;
+			best_cols = pcols;
+			best_rows = prows;
+		}
+	}
+	if (!best)
+		return (false);
+
+	cv::Mat bytes(1, static_cast<int>(best->length), CV_8UC1,
+				  const_cast<unsigned char*>(file.data() + best->offset));	//!< Preview
+	cv::Mat img;				//!< Decoded preview
+	{
+		StageTimer timer(Stage::decode, path);
+		img = cv::imdecode(bytes, decode_mode(best_cols, best_rows, maxrows, maxcols));
+		if (img.empty())
+			return (false);
+		orient(img, info.orientation);
+	}
+
+	frame.cols = ocols;
+	frame.rows = orows;
+	StageTimer timer(Stage::scale, path);
+	frame.image = scale_to_fit(img, maxrows, maxcols);
+
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Choose whether to use the previews embedded in JPEG files
+ *
+ * Previews are used by default.  They may be turned off for the best quality,
+ * since cameras compress them harder than the main image.
+ *
+ * @param [in] use true to use previews, false to always decode the main image
+ *****************************************************************************/
+
+void use_previews(bool use)
+{
+	previews = use;
+}
+
+/******************************************************************************
+ * \brief Choose whether to hash the frames loaded
+ *
+ * Hashing reads the whole file even when an embedded preview would do, so it
+ * is off unless duplicates are looked for.
+ *
+ * @param [in] use true to hash the frames, false otherwise
+ *****************************************************************************/
+
+void use_hashes(bool use)
+{
+	hashes = use;
+}
+
+/******************************************************************************
+ * \brief Find out if the frames loaded are hashed
+ *
+ * \return true if the frames are hashed, false otherwise
+ *****************************************************************************/
+
+bool hashes_used()
+{
+	return (hashes);
+}
+
+/******************************************************************************
+ * \brief Read an image file and prepare it for display
+ *
+ * Decode the specified file and scale the image to fit in the display window.
+ * The file is mapped into memory and decoded from there, with no copy of its
+ * contents, unless MappedFile reads it into a buffer instead.  If the file is a JPEG file with a preview embedded that is big
+ * enough, the preview is used instead.  Otherwise, if the file is a JPEG file
+ * and the size of the image can be found from its header, the image is
+ * decoded at the lowest resolution that still fills the window.  Other
+ * images are decoded in full, and scale_to_fit() reduces them with its area
+ * filter.  If the file does not contain an image, the frame returned has an
+ * empty image.  If hashing is turned on, the file contents and the scaled
+ * image are hashed.
+ *
+ * @param [in] path name of the file to read
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return frame ready to be displayed
+ * \sa scale_to_fit(), MappedFile
+ *****************************************************************************/
+
+Frame load_frame(const std::string& path, int maxrows, int maxcols)
+{
+	Frame frame;				//!< Frame to be returned
+	int cols, rows;				//!< Size of the image from its header
+	int mode = cv::IMREAD_COLOR;	//!< Flags for cv::imdecode
+
+	StageTimer reading(Stage::read, path);
+	MappedFile file(path);
+	if (!file.data())
+		return (frame);
+	frame.read = true;
+
+	bool known = image_size(file.data(), file.size(), cols, rows);
+	reading.stop();
+	if (hashes)
+		frame.digest = xxhash64(file.data(), file.size());
+	if (known && previews && file.size() <= static_cast<size_t>(INT_MAX) &&
+		load_preview(path, file, cols, rows, maxrows, maxcols, frame))
+	{
+		if (hashes)
+			frame.dhash = dhash(frame.image);
+		return (frame);
+	}
+	if (known && is_jpeg(file.data(), file.size()))
+		mode = decode_mode(cols, rows, maxrows, maxcols);
+
+	// A Mat cannot wrap more than INT_MAX bytes; let OpenCV read such files
+	// itself.
+
+	StageTimer decoding(Stage::decode, path);
+	cv::Mat img;				//!< Decoded image
+	if (file.size() > static_cast<size_t>(INT_MAX))
+	{
+		img = cv::imread(path, mode);
+	}
+	else
+	{
+		cv::Mat bytes(1, static_cast<int>(file.size()), CV_8UC1,
+					  const_cast<unsigned char*>(file.data()));	//!< Contents of the file
+		img = cv::imdecode(bytes, mode);
+	}
+	decoding.stop();
+	if (img.empty())
+		return (frame);
+
+	// Report the resolution of the original image, not the reduced one,
+	// keeping the orientation of the decoded image.
+
+	if (known && mode != cv::IMREAD_COLOR)
+	{
+		if ((img.cols > img.rows) != (cols > rows))
+			std::swap(cols, rows);
+		frame.cols = cols;
+		frame.rows = rows;
+	}
+	else
+	{
+		frame.cols = img.cols;
+		frame.rows = img.rows;
+	}
+	StageTimer scaling(Stage::scale, path);
+	frame.image = scale_to_fit(img, maxrows, maxcols);
+	if (hashes)
+		frame.dhash = dhash(frame.image);
+
+	return (frame);
+}
+
+/******************************************************************************
+ * \brief Prepare a rough frame to show while an image is being decoded
+ *
+ * Only large JPEG images can be decoded much faster at low resolution: from
+ * the smallest preview embedded in the file with the same shape as the main
+ * image, or else from the main image reduced by 8 while decoding.  The rough
+ * image is enlarged to the size of the final frame, so that the final frame
+ * replaces it in place.  Other files, and images small enough to decode in
+ * full about as fast, give a frame with an empty image.
+ *
+ * @param [in] path name of the file to read
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return rough frame, with an empty image if there is none
+ * \sa load_frame()
+ *****************************************************************************/
+
+Frame quick_frame(const std::string& path, int maxrows, int maxcols)
+{
+	Frame frame;				//!< Frame to be returned
+	int cols, rows;				//!< Size of the image from its header
+
+	MappedFile file(path);
+	ExifInfo info;
+	if (!file.data() || file.size() > static_cast<size_t>(INT_MAX) ||
+		!is_jpeg(file.data(), file.size()) || !image_size(file.data(), file.size(), cols, rows) ||
+		static_cast<size_t>(cols) * rows < quick_pixels ||
+		!read_exif(file.data(), file.size(), info))
+		return (frame);
+
+	const Preview* best = nullptr;	//!< Smallest preview found so far
+	int best_cols = 0;				//!< Number of columns in the preview picked
+	for (const auto& p : info.previews)
+	{
+		int pcols, prows;
+		if (image_size(file.data() + p.offset, p.length, pcols, prows) &&
+			same_shape(pcols, prows, cols, rows) && (!best || pcols < best_cols))
+		{
+			best = &p;
+			best_cols = pcols;
+		}
+	}
+
+	cv::Mat img;				//!< Decoded rough image
+	if (best)
+	{
+		cv::Mat bytes(1, static_cast<int>(best->length), CV_8UC1,
+					  const_cast<unsigned char*>(file.data() + best->offset));	//!< Preview
+		img = cv::imdecode(bytes, cv::IMREAD_COLOR);
+		if (!img.empty())
+			orient(img, info.orientation);
+	}
+	if (img.empty())
+	{
+		cv::Mat bytes(1, static_cast<int>(file.size()), CV_8UC1,
+					  const_cast<unsigned char*>(file.data()));	//!< Contents of the file
+		img = cv::imdecode(bytes, cv::IMREAD_REDUCED_COLOR_8);
+	}
+	if (img.empty())
+		return (frame);
+
+	bool turned = info.orientation >= 5;
+	frame.cols = turned ? rows : cols;
+	frame.rows = turned ? cols : rows;
+	frame.image = scale_to_fit(img, maxrows, maxcols);
+
+	return (frame);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+/******************************************************************************
+ * \brief Decoded image ready for display
+ *
+ * A frame holds the image already scaled to fit the display window, along
+ * with the resolution of the original image.  An empty image means that the
+ * file does not contain an image.  When hashing is turned on, the frame also
+ * carries a hash of the file contents, to find exact duplicates, and a
+ * perceptual hash of the image, to find images that look alike.  The time
+ * the frame took to load tells caches what keeping it saves.  A file that
+ * could not be read at all gives an empty image too, but is not marked read,
+ * so that it is not taken for a file that holds no image.
+ *****************************************************************************/
+
+struct Frame
+{
+	cv::Mat image;		//!< Image scaled to fit the display window
+	int cols = 0;		//!< Number of columns in the original image
+	int rows = 0;		//!< Number of rows in the original image
+	uint64_t digest = 0;	//!< Hash of the contents of the file, or 0 if not hashed
+	uint64_t dhash = 0;		//!< Perceptual hash of the image, or 0 if not hashed
+	float cost = 0;			//!< Milliseconds it took to load the frame, or 0 if unknown
+	bool read = false;		//!< Set if the file was read, so an empty image means no image
+};
+
+Frame load_frame(const std::string& path, int maxrows, int maxcols);
+Frame quick_frame(const std::string& path, int maxrows, int maxcols);
+void use_previews(bool use);
+void use_hashes(bool use);
+bool hashes_used();
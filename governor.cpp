@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "stats.hpp"
+#include "governor.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+static std::mutex registry_lock;		//!< Protects consumers, and serializes shedding
+static std::vector<std::pair<int, MemoryGovernor::Consumer*>> consumers;	//!< Consumers by rank
+static std::atomic<size_t> budget(0);	//!< Most bytes held by all consumers, or 0 for no limit
+
+static const double min_available = 0.05;	//!< Fraction of memory free below which is pressure
+static const std::chrono::seconds poll_interval(1);	//!< Time between pressure checks
+
+/******************************************************************************
+ * \brief Add up the bytes held by all consumers
+ *
+ * Must be called with registry_lock held.
+ *
+ * \return number of bytes held
+ *****************************************************************************/
+
+static size_t held_total()
+{
+	size_t total = 0;					//!< Bytes held by all consumers
+	for (const auto& c : consumers)
+		total += c.second->held();
+
+	return (total);
+}
+
+/******************************************************************************
+ * \brief Shed bytes from the consumers until they hold no more than a limit
+ *
+ * Must be called with registry_lock held.  What one consumer sheds may land
+ * in another of lower rank, as the buffers of frames evicted from the cache
+ * go back to the free lists of the pool, so the consumers are asked again in
+ * rank order, counting what they hold afresh, until they fit in the limit or
+ * none of them has anything left to shed.
+ *
+ * @param [in] limit most bytes held by all consumers
+ *****************************************************************************/
+
+static void shed_to(size_t limit)
+{
+	size_t total = held_total();		//!< Bytes held by all consumers
+
+	while (total > limit)
+	{
+		size_t released = 0;			//!< Bytes shed in this pass
+		for (const auto& c : consumers)
+		{
+			if (total <= limit)
+				break;
+			released += c.second->shed(total - limit);
+			total = held_total();
+		}
+		if (released == 0)
+			break;
+	}
+}
+
+/******************************************************************************
+ * \brief Find out if the system is short of memory
+ *
+ * In Linux, memory is short when less than 5% of it is available.  In Apple,
+ * it is when the kernel reports a memory pressure level of warning or worse,
+ * and in Windows when the system signals low memory.
+ *
+ * \return true if the system is short of memory
+ *****************************************************************************/
+
+static bool under_pressure()
+{
+#ifdef _WIN32
+	static HANDLE low = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+	BOOL state = FALSE;
+	return (low && QueryMemoryResourceNotification(low, &state) && state);
+#elif defined(__APPLE__)
+	int level = 0;
+	size_t size = sizeof(level);
+	return (sysctlbyname("kern.memorystatus_vm_pressure_level", &level, &size, NULL, 0) == 0 &&
+			level >= 2);
+#else
+	std::ifstream in("/proc/meminfo");
+	std::string line;
+	uint64_t total = 0, available = 0;	//!< Memory in kB
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string name;
+		uint64_t value;
+		if (!(fields >> name >> value))
+			continue;
+		if (name == "MemTotal:")
+			total = value;
+		else if (name == "MemAvailable:")
+			available = value;
+	}
+	return (total > 0 && available > 0 && available < total * min_available);
+#endif
+}
+
+/******************************************************************************
+ * \brief Start governing memory
+ *
+ * Start the thread polling for memory pressure.
+ *
+ * @param [in] limit most bytes held by all consumers together, or 0 for no
+ *             limit other than memory pressure
+ *****************************************************************************/
+
+MemoryGovernor::MemoryGovernor(size_t limit)
+{
+	budget = limit;
+	thread = std::thread(&MemoryGovernor::monitor, this);
+}
+
+/******************************************************************************
+ * \brief Stop governing memory
+ *
+ * The global budget is lifted, and the pressure thread stopped.
+ *****************************************************************************/
+
+MemoryGovernor::~MemoryGovernor()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	stop.notify_all();
+	thread.join();
+	budget = 0;
+}
+
+/******************************************************************************
+ * \brief Enroll a consumer of memory
+ *
+ * @param [in] consumer consumer to be accounted for
+ * @param [in] rank order in which consumers shed memory, lowest first
+ *****************************************************************************/
+
+void MemoryGovernor::enroll(Consumer* consumer, int rank)
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	auto pos = std::upper_bound(consumers.begin(), consumers.end(), rank,
+								[](int r, const std::pair<int, Consumer*>& c) { return (r < c.first); });
+	consumers.insert(pos, std::make_pair(rank, consumer));
+}
+
+/******************************************************************************
+ * \brief Remove a consumer of memory
+ *
+ * Must be called before the consumer is destroyed.
+ *
+ * @param [in] consumer consumer enrolled
+ *****************************************************************************/
+
+void MemoryGovernor::leave(Consumer* consumer)
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	consumers.erase(std::remove_if(consumers.begin(), consumers.end(),
+								   [consumer](const std::pair<int, Consumer*>& c) {
+									   return (c.second == consumer);
+								   }),
+					consumers.end());
+}
+
+/******************************************************************************
+ * \brief Bring the memory held within the global budget
+ *
+ * Called by consumers after they grow.  Does nothing if there is no budget.
+ *****************************************************************************/
+
+void MemoryGovernor::balance()
+{
+	size_t limit = budget;
+	if (limit == 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	shed_to(limit);
+}
+
+/******************************************************************************
+ * \brief Find the room a consumer has in the global budget
+ *
+ * Consumers of lower rank shed before this one, so only the memory held by the
+ * others of the same rank or higher is taken off the budget.
+ *
+ * @param [in] consumer consumer enrolled
+ * \return most bytes the consumer may hold, or SIZE_MAX if there is no budget
+ *****************************************************************************/
+
+size_t MemoryGovernor::room(const Consumer* consumer)
+{
+	size_t limit = budget;
+	if (limit == 0)
+		return (SIZE_MAX);
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	auto self = std::find_if(consumers.begin(), consumers.end(),
+							 [consumer](const std::pair<int, Consumer*>& c) {
+								 return (c.second == consumer);
+							 });
+	size_t total = 0;					//!< Bytes held by the others that do not shed first
+	for (const auto& c : consumers)
+		if (self != consumers.end() && c.first >= self->first && c.second != consumer)
+			total += c.second->held();
+
+	return (total < limit ? limit - total : 0);
+}
+
+/******************************************************************************
+ * \brief Poll for memory pressure until told to exit
+ *
+ * On pressure, the consumers shed half of what they hold, and the event is
+ * counted in the statistics.
+ *****************************************************************************/
+
+void MemoryGovernor::monitor()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (!stop.wait_for(guard, poll_interval, [this]() { return (done); }))
+	{
+		guard.unlock();
+		if (under_pressure())
+		{
+			Stats::add(Counter::pressure);
+			std::lock_guard<std::mutex> registry(registry_lock);
+			shed_to(held_total() / 2);
+		}
+		guard.lock();
+	}
+}
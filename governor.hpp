@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/******************************************************************************
+ * \brief Governor of the memory held by all the caches together
+ *
+ * Each cache keeps to a budget of its own, but together they may still hold
+ * more than the machine can spare.  Every holder of image memory enrolls as a
+ * consumer, and whenever one of them grows, the governor adds up what all of
+ * them hold and, while that is over the global budget, asks them to shed
+ * bytes in order of rank: lowest rank first, so that free buffers go before
+ * decoded frames.  Consumers that cannot shed, such as the levels of the
+ * image being zoomed into, still count, and size themselves to the room the
+ * others leave them.
+ * The governor also polls the system for memory pressure, and on pressure
+ * sheds half of what the consumers hold.
+ *
+ * Consumers enroll and leave through static functions, so that they need no
+ * governor to be passed around; with no governor, there is no global budget.
+ * A consumer must not hold its own lock when calling balance(), since the
+ * governor calls back into every consumer.  All functions can be called from
+ * any thread.
+ *****************************************************************************/
+
+class MemoryGovernor
+{
+public:
+	//!< Holder of memory accounted for by the governor
+	class Consumer
+	{
+	public:
+		virtual ~Consumer() {}
+		virtual size_t held() const = 0;	//!< Number of bytes held
+		virtual size_t shed(size_t bytes) = 0;	//!< Release about bytes, return bytes released
+	};
+
+	explicit MemoryGovernor(size_t budget);
+	~MemoryGovernor();
+
+	MemoryGovernor(const MemoryGovernor&) = delete;
+	MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+	static void enroll(Consumer* consumer, int rank);
+	static void leave(Consumer* consumer);
+	static void balance();
+	static size_t room(const Consumer* consumer);
+
+private:
+	void monitor();
+
+	std::thread thread;				//!< Thread polling for memory pressure
+	std::mutex lock;				//!< Protects done
+	std::condition_variable stop;	//!< Signalled when done is set
+	bool done = false;				//!< Set when the thread must exit
+};
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include "dir.hpp"
+#include "filelist.hpp"
+#include "frame.hpp"
+#include "governor.hpp"
+#include "cache.hpp"
+#include "diskcache.hpp"
+#include "prefetch.hpp"
+#include "keycode.hpp"
+#include "stats.hpp"
+#include "grid.hpp"
+
+static const int margin = 3;	//!< Space between a thumbnail and the edge of its tile
+
+/******************************************************************************
+ * \brief Prepare a contact sheet
+ *
+ * The window is split into gcols x grows tiles, and thumbnails are scaled to
+ * fit a tile less its margin.  The next and previous pages are prefetched.
+ *
+ * @param [in] gcols number of columns of thumbnails
+ * @param [in] grows number of rows of thumbnails
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [in] readahead number of files to read ahead after those prefetched
+ * @param [in] cache cache to look up thumbnails in before decoding them
+ * @param [in] disk disk cache to look up thumbnails in, or NULL
+ *****************************************************************************/
+
+ContactSheet::ContactSheet(int gcols, int grows, int maxrows, int maxcols, int readahead,
+						   FrameCache& cache, DiskCache* disk) :
+	gcols(gcols), grows(grows), cells(gcols * grows),
+	tile_w(maxcols / gcols), tile_h(maxrows / grows),
+	maxrows(maxrows), maxcols(maxcols),
+	prefetch(gcols * grows, gcols * grows, readahead,
+			 std::max(maxrows / grows - 2 * margin, 1),
+			 std::max(maxcols / gcols - 2 * margin, 1), cache, disk)
+{
+}
+
+/******************************************************************************
+ * \brief Fill a page with thumbnails
+ *
+ * Take the thumbnails of the first cells images from the specified file on,
+ * waiting for the scan if need be.  Files that turn out not to be images are
+ * dropped from the list and skipped.
+ *
+ * @param [in,out] files list of files being browsed
+ * @param [in] first index of the first file of the page
+ *****************************************************************************/
+
+void ContactSheet::collect(FileList& files, size_t first)
+{
+	tiles.clear();
+	thumbs.clear();
+
+	if (files.wait(first))
+		prefetch.position(files, first, cells);
+
+	for (size_t k = first; tiles.size() < static_cast<size_t>(cells) && files.wait(k); k++)
+	{
+		if (files.dropped(k))
+			continue;
+
+		Frame thumb = prefetch.get(files[k]);
+		if (thumb.image.empty())
+		{
+			files.drop(k);
+			continue;
+		}
+
+		tiles.push_back(k);
+		thumbs.push_back(thumb);
+	}
+}
+
+/******************************************************************************
+ * \brief Find the first file of the page before the specified one
+ *
+ * @param [in] files list of files being browsed
+ * @param [in] first index of the first file of the current page
+ * \return index of the first file of the previous page
+ *****************************************************************************/
+
+size_t ContactSheet::previous_page(const FileList& files, size_t first) const
+{
+	size_t k = first;			//!< Index of the file being looked at
+	int count = 0;				//!< Number of images found before first
+
+	while (k > 0 && count < cells)
+	{
+		k--;
+		if (!files.dropped(k))
+			count++;
+	}
+
+	return (k);
+}
+
+/******************************************************************************
+ * \brief Draw the page with the selected thumbnail framed
+ *
+ * Each thumbnail is centered in its tile.
+ *
+ * @param [in] selected tile of the selected thumbnail
+ *****************************************************************************/
+
+void ContactSheet::compose(size_t selected)
+{
+	canvas.create(maxrows, maxcols, CV_8UC3);
+	canvas.setTo(cv::Scalar::all(0));
+
+	for (size_t t = 0; t < thumbs.size(); t++)
+	{
+		int x = static_cast<int>(t % gcols) * tile_w;
+		int y = static_cast<int>(t / gcols) * tile_h;
+		const cv::Mat& img = thumbs[t].image;
+
+		cv::Rect place(x + (tile_w - img.cols) / 2, y + (tile_h - img.rows) / 2,
+					   img.cols, img.rows);
+		img.copyTo(canvas(place));
+
+		if (t == selected)
+			cv::rectangle(canvas, cv::Rect(x + 1, y + 1, tile_w - 2, tile_h - 2),
+						  cv::Scalar(0, 255, 255), 2);
+	}
+}
+
+/******************************************************************************
+ * \brief Browse the images as pages of thumbnails
+ *
+ * Start with the page beginning at the specified file.  The arrow keys (or h,
+ * j, k, l) move the selection, going over to the next or previous page at the
+ * edges; n, space, and Page Down show the next page, and p and Page Up the
+ * previous one.  Enter picks the selected image, and q quits.
+ *
+ * @param [in,out] files list of files being browsed
+ * @param [in,out] i index of the file to start with; on return, index of the
+ *                 image picked
+ * \return true if an image was picked, false if the user quit or there are no
+ *         images
+ *****************************************************************************/
+
+bool ContactSheet::browse(FileList& files, size_t& i)
+{
+	size_t first = i;			//!< Index of the first file of the page
+	size_t shown = SIZE_MAX;	//!< Index of the first file of the page collected
+	size_t sel = 0;				//!< Tile of the selected thumbnail
+
+	for (;;)
+	{
+		if (first != shown)
+		{
+			collect(files, first);
+			shown = first;
+		}
+
+		// No image from first on: go back a page, or give up if there is none
+
+		if (tiles.empty())
+		{
+			if (first == 0)
+				return (false);
+			first = previous_page(files, first);
+			continue;
+		}
+
+		sel = std::min(sel, tiles.size() - 1);
+		compose(sel);
+
+		std::cout << std::setw(5) << tiles[sel] << ". " << std::setw(60) << files[tiles[sel]]
+				 << "\t" << thumbs[sel].cols << "x" << thumbs[sel].rows << std::endl;
+		cv::imshow("Browser", canvas);
+		Stats::reached(Milestone::first_frame);
+
+		bool full = tiles.size() == static_cast<size_t>(cells);	//!< Set if a next page may exist
+		size_t next = tiles.back() + 1;		//!< Index of the first file of the next page
+
+		switch (read_key())
+		{
+			case 'q':					// Quit
+				return (false);
+
+			case '\r':					// Pick the selected image
+			case '\n':
+				i = tiles[sel];
+				return (true);
+
+			case KEY_RIGHT:
+			case 'l':
+				if (sel + 1 < tiles.size())
+					sel++;
+				else if (full && files.wait(next))
+				{
+					first = next;
+					sel = 0;
+				}
+				break;
+
+			case KEY_LEFT:
+			case 'h':
+				if (sel > 0)
+					sel--;
+				else if (first > 0)
+				{
+					first = previous_page(files, first);
+					sel = cells - 1;
+				}
+				break;
+
+			case KEY_DOWN:
+			case 'j':
+				if (sel + gcols < tiles.size())
+					sel += gcols;
+				else if (full && files.wait(next))
+				{
+					first = next;
+					sel %= gcols;
+				}
+				break;
+
+			case KEY_UP:
+			case 'k':
+				if (sel >= static_cast<size_t>(gcols))
+					sel -= gcols;
+				else if (first > 0)
+				{
+					first = previous_page(files, first);
+					sel += (grows - 1) * gcols;
+				}
+				break;
+
+			case 'n':
+			case ' ':
+			case KEY_PAGE_DOWN:
+				if (full && files.wait(next))
+				{
+					first = next;
+					sel = 0;
+				}
+				break;
+
+			case 'p':
+			case KEY_PAGE_UP:
+				if (first > 0)
+				{
+					first = previous_page(files, first);
+					sel = 0;
+				}
+				break;
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/******************************************************************************
+ * \brief Contact sheet of thumbnails filling the display window
+ *
+ * The sheet shows a page of gcols x grows thumbnails of consecutive images at
+ * once, with one of them selected.  The thumbnails are decoded and scaled by
+ * a prefetcher of their own, at the size of a tile, so those of the current
+ * page are decoded in parallel and those of the next and previous pages are
+ * decoded in background while the page is on screen.
+ *****************************************************************************/
+
+class ContactSheet
+{
+public:
+	ContactSheet(int gcols, int grows, int maxrows, int maxcols, int readahead,
+				 FrameCache& cache, DiskCache* disk);
+
+	bool browse(FileList& files, size_t& i);
+
+private:
+	void collect(FileList& files, size_t first);
+	size_t previous_page(const FileList& files, size_t first) const;
+	void compose(size_t selected);
+
+	int gcols;					//!< Number of columns of thumbnails
+	int grows;					//!< Number of rows of thumbnails
+	int cells;					//!< Number of thumbnails on a page
+	int tile_w;					//!< Width of the tile holding a thumbnail
+	int tile_h;					//!< Height of the tile holding a thumbnail
+	int maxrows;				//!< Maximum number of rows in display window
+	int maxcols;				//!< Maximum number of columns in display window
+	Prefetcher prefetch;		//!< Decoder of thumbnails
+	std::vector<size_t> tiles;	//!< Index of the file in each tile of the page
+	std::vector<Frame> thumbs;	//!< Thumbnail in each tile of the page
+	cv::Mat canvas;				//!< Page being displayed, kept from page to page
+};
@@ -0,0 +1,180 @@
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include "hash.hpp"
+
+static const uint64_t prime1 = 11400714785074694791ULL;	//!< Primes of XXH64
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+/******************************************************************************
+ * \brief Rotate a 64-bit value left
+ *
+ * @param [in] x value to rotate
+ * @param [in] r number of bits to rotate by, 1 to 63
+ * \return rotated value
+ *****************************************************************************/
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return ((x << r) | (x >> (64 - r)));
+}
+
+/******************************************************************************
+ * \brief Read a little-endian value from unaligned memory
+ *
+ * @param [in] p start of the value
+ * \return the value
+ *****************************************************************************/
+
+template <typename T> static inline uint64_t read_le(const unsigned char* p)
+{
+	uint64_t value = 0;
+	for (size_t k = 0; k < sizeof(T); k++)
+		value |= static_cast<uint64_t>(p[k]) << (8 * k);
+	return (value);
+}
+
+/******************************************************************************
+ * \brief Mix one 8-byte lane into an XXH64 accumulator
+ *
+ * @param [in] acc accumulator
+ * @param [in] input lane
+ * \return new accumulator
+ *****************************************************************************/
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+	acc += input * prime2;
+	acc = rotl(acc, 31);
+	return (acc * prime1);
+}
+
+/******************************************************************************
+ * \brief Hash bytes with XXH64
+ *
+ * XXH64 runs four independent accumulators over 32-byte stripes, which the
+ * compiler keeps in registers and the CPU runs in parallel, so hashing a file
+ * costs about as much as reading it from memory.  The result matches the
+ * reference implementation.
+ *
+ * @param [in] data bytes to hash
+ * @param [in] n number of bytes
+ * @param [in] seed seed of the hash
+ * \return hash value
+ *****************************************************************************/
+
+uint64_t xxhash64(const unsigned char* data, size_t n, uint64_t seed)
+{
+	const unsigned char* p = data;
+	const unsigned char* end = data + n;
+	uint64_t h;
+
+	if (n >= 32)
+	{
+		uint64_t v1 = seed + prime1 + prime2;
+		uint64_t v2 = seed + prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - prime1;
+
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = xxh_round(v1, read_le<uint64_t>(p));
+			v2 = xxh_round(v2, read_le<uint64_t>(p + 8));
+			v3 = xxh_round(v3, read_le<uint64_t>(p + 16));
+			v4 = xxh_round(v4, read_le<uint64_t>(p + 24));
+		}
+
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		for (uint64_t v : { v1, v2, v3, v4 })
+		{
+			h ^= xxh_round(0, v);
+			h = h * prime1 + prime4;
+		}
+	}
+	else
+	{
+		h = seed + prime5;
+	}
+
+	h += static_cast<uint64_t>(n);
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= xxh_round(0, read_le<uint64_t>(p));
+		h = rotl(h, 27) * prime1 + prime4;
+	}
+	if (p + 4 <= end)
+	{
+		h ^= read_le<uint32_t>(p) * prime1;
+		h = rotl(h, 23) * prime2 + prime3;
+		p += 4;
+	}
+	for (; p < end; p++)
+	{
+		h ^= *p * prime5;
+		h = rotl(h, 11) * prime1;
+	}
+
+	h ^= h >> 33;
+	h *= prime2;
+	h ^= h >> 29;
+	h *= prime3;
+	h ^= h >> 32;
+
+	return (h);
+}
+
+/******************************************************************************
+ * \brief Find the perceptual hash of an image
+ *
+ * The difference hash shrinks the image to 9x8 in gray, and sets one bit for
+ * each pair of neighbours in a row telling whether the left one is brighter.
+ * It survives scaling, recompression, and small changes in exposure, so
+ * images that look alike have hashes a few bits apart.  The shrinking is
+ * done by OpenCV's vectorized resize, so the hash costs little next to the
+ * scaling the frame went through already.
+ *
+ * @param [in] img image to hash, BGR or gray
+ * \return hash value, or 0 for an empty image
+ *****************************************************************************/
+
+uint64_t dhash(const cv::Mat& img)
+{
+	if (img.empty())
+		return (0);
+
+	cv::Mat gray, small;
+	if (img.channels() == 1)
+		gray = img;
+	else
+		cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+	cv::resize(gray, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+	uint64_t h = 0;
+	for (int r = 0; r < 8; r++)
+	{
+		const uchar* row = small.ptr<uchar>(r);
+		for (int c = 0; c < 8; c++)
+			h = (h << 1) | (row[c] > row[c + 1] ? 1 : 0);
+	}
+
+	return (h);
+}
+
+/******************************************************************************
+ * \brief Count the bits in which two hashes differ
+ *
+ * @param [in] a first hash
+ * @param [in] b second hash
+ * \return number of bits that differ, 0 to 64
+ *****************************************************************************/
+
+int hamming(uint64_t a, uint64_t b)
+{
+	return (static_cast<int>(std::bitset<64>(a ^ b).count()));
+}
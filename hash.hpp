@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+uint64_t xxhash64(const unsigned char* data, size_t n, uint64_t seed = 0);
+uint64_t dhash(const cv::Mat& img);
+int hamming(uint64_t a, uint64_t b);
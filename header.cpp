@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "mapfile.hpp"
+#include "header.hpp"
+
+/******************************************************************************
+ * \brief Read a big-endian 16-bit value from memory
+ *
+ * @param [in] b bytes to read from
+ * \return value read
+ *****************************************************************************/
+
+static int read_u16(const unsigned char* b)
+{
+	return ((b[0] << 8) | b[1]);
+}
+
+/******************************************************************************
+ * \brief Find the size of a JPEG image from its frame header
+ *
+ * Walk the markers after SOI until a start-of-frame marker is found, skipping
+ * every other segment by its length.
+ *
+ * @param [in] b contents of the file
+ * @param [in] n size of the file
+ * @param [out] cols number of columns in the image
+ * @param [out] rows number of rows in the image
+ * \return true if the frame header was found, false otherwise
+ *****************************************************************************/
+
+static bool jpeg_size(const unsigned char* b, size_t n, int& cols, int& rows)
+{
+	size_t pos = 2;						//!< Position just after SOI
+
+	for (;;)
+	{
+		if (pos >= n || b[pos] != 0xFF)
+			return (false);
+
+		// Skip fill bytes in front of the marker
+
+		while (pos < n && b[pos] == 0xFF)
+			pos++;
+		if (pos >= n)
+			return (false);
+		int c = b[pos++];
+
+		// Standalone markers carry no length
+
+		if (c == 0x01 || (c >= 0xD0 && c <= 0xD7))
+			continue;
+		if (c == 0xD9 || c == 0xDA)		// End of image or start of scan
+			return (false);
+
+		if (pos + 2 > n)
+			return (false);
+		size_t length = read_u16(b + pos);
+		if (length < 2)
+			return (false);
+
+		// SOF0 to SOF15, except DHT, JPG, and DAC which share the range
+
+		if (c >= 0xC0 && c <= 0xCF && c != 0xC4 && c != 0xC8 && c != 0xCC)
+		{
+			if (pos + 7 > n)
+				return (false);
+			rows = read_u16(b + pos + 3);	// After length and sample precision
+			cols = read_u16(b + pos + 5);
+			return (rows > 0 && cols > 0);
+		}
+
+		pos += length;
+	}
+}
+
+/******************************************************************************
+ * \brief Find the size of a PNG image from its header chunk
+ *
+ * The IHDR chunk must immediately follow the signature.
+ *
+ * @param [in] b contents of the file
+ * @param [in] n size of the file
+ * @param [out] cols number of columns in the image
+ * @param [out] rows number of rows in the image
+ * \return true if the header chunk was found, false otherwise
+ *****************************************************************************/
+
+static bool png_size(const unsigned char* b, size_t n, int& cols, int& rows)
+{
+	if (n < 24 || memcmp(b + 12, "IHDR", 4) != 0)
+		return (false);
+
+	cols = static_cast<int>((b[16] << 24) | (b[17] << 16) | (b[18] << 8) | b[19]);
+	rows = static_cast<int>((b[20] << 24) | (b[21] << 16) | (b[22] << 8) | b[23]);
+	return (rows > 0 && cols > 0);
+}
+
+/******************************************************************************
+ * \brief Find the size of an image in memory without decoding it
+ *
+ * Look at just enough of the file header to find the resolution of the
+ * image.  Only JPEG and PNG files are recognized; for any other file, and
+ * for files with a damaged header, false is returned.
+ *
+ * @param [in] data contents of the file
+ * @param [in] n size of the file
+ * @param [out] cols number of columns in the image
+ * @param [out] rows number of rows in the image
+ * \return true if the size was found, false otherwise
+ *****************************************************************************/
+
+bool image_size(const unsigned char* data, size_t n, int& cols, int& rows)
+{
+	static const unsigned char png[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+	if (n >= 2 && data[0] == 0xFF && data[1] == 0xD8)
+		return (jpeg_size(data, n, cols, rows));
+	if (n >= 8 && std::equal(data, data + 8, png))
+		return (png_size(data, n, cols, rows));
+	return (false);
+}
+
+/******************************************************************************
+ * \brief Find the size of an image file without decoding it
+ *
+ * The file is mapped rather than read, so that only the pages holding the
+ * header are brought in.
+ *
+ * @param [in] path name of the file
+ * @param [out] cols number of columns in the image
+ * @param [out] rows number of rows in the image
+ * \return true if the size was found, false otherwise
+ * \sa MappedFile
+ *****************************************************************************/
+
+bool image_size(const std::string& path, int& cols, int& rows)
+{
+	MappedFile file(path);
+	return (file.data() && image_size(file.data(), file.size(), cols, rows));
+}
+
+/******************************************************************************
+ * \brief Find out if a file name has an extension of a format known not to
+ *        be an image
+ *
+ * OpenCV picks the decoder from the contents of a file, not from its name,
+ * so images with unusual extensions, such as .jfif, or saved under a wrong
+ * one, can only be told by their first bytes.  Only the extensions of the
+ * sidecar, text, video, audio, and archive files commonly found next to
+ * images are turned down by name.
+ *
+ * @param [in] path name of the file
+ * \return true if the file is not an image judging by its name
+ *****************************************************************************/
+
+static bool other_extension(const std::string& path)
+{
+	static const char* extensions[] =
+	{
+		"xmp", "thm", "aae", "dop", "pp3", "xml", "json", "txt", "md", "nfo",
+		"log", "csv", "ini", "db", "htm", "html", "pdf",
+		"mp4", "m4v", "mov", "avi", "mkv", "mts", "m2ts", "3gp", "wmv", "webm",
+		"mpg", "mpeg", "flv", "lrv",
+		"mp3", "wav", "m4a", "aac", "flac", "ogg",
+		"zip", "gz", "tar", "7z", "rar"
+	};
+
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return (false);
+
+	std::string ext = path.substr(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(),
+				   [](unsigned char c) { return static_cast<char>(tolower(c)); });
+
+	for (const char* e : extensions)
+		if (ext == e)
+			return (true);
+	return (false);
+}
+
+/******************************************************************************
+ * \brief Find out if the first bytes of a file match an image format
+ *
+ * @param [in] b first bytes of the file
+ * @param [in] n number of bytes in b, at most 16
+ * \return true if the bytes start a JPEG, PNG, BMP, TIFF, WebP, JPEG 2000,
+ *         PNM, Sun raster, OpenEXR, Radiance HDR, GIF, or AVIF file
+ *****************************************************************************/
+
+static bool image_magic(const unsigned char* b, size_t n)
+{
+	//!< Compare the bytes at offset off with a signature of len bytes
+	auto match = [b, n](size_t off, const char* sig, size_t len) {
+		return (off + len <= n && memcmp(b + off, sig, len) == 0);
+	};
+
+	return (match(0, "\xFF\xD8\xFF", 3) ||					// JPEG
+			match(0, "\x89PNG\r\n\x1A\n", 8) ||				// PNG
+			match(0, "BM", 2) ||							// BMP
+			match(0, "II*\0", 4) || match(0, "MM\0*", 4) ||	// TIFF
+			match(0, "II+\0", 4) || match(0, "MM\0+", 4) ||	// BigTIFF
+			(match(0, "RIFF", 4) && match(8, "WEBP", 4)) ||	// WebP
+			match(0, "\0\0\0\x0CjP  \r\n\x87\n", 12) ||		// JPEG 2000 file
+			match(0, "\xFF\x4F\xFF\x51", 4) ||				// JPEG 2000 codestream
+			(n >= 2 && b[0] == 'P' && ((b[1] >= '1' && b[1] <= '7') ||
+									   b[1] == 'F' || b[1] == 'f')) ||	// PNM, PFM
+			match(0, "\x59\xA6\x6A\x95", 4) ||				// Sun raster
+			match(0, "\x76\x2F\x31\x01", 4) ||				// OpenEXR
+			match(0, "#?RADIANCE", 10) || match(0, "#?RGBE", 6) ||	// Radiance HDR
+			match(0, "GIF87a", 6) || match(0, "GIF89a", 6) ||	// GIF
+			(match(4, "ftyp", 4) && (match(8, "avif", 4) || match(8, "avis", 4))));	// AVIF
+}
+
+/******************************************************************************
+ * \brief Find out if a file looks like an image without decoding it
+ *
+ * Files whose extension is that of a sidecar, text, or video format, among
+ * others, are rejected without being opened, so directories full of them cost
+ * no I/O.  Other files, whatever their extension, are accepted if their first
+ * 16 bytes match the signature of a format OpenCV can read.  A file accepted here may still fail to
+ * decode, but a file rejected here would certainly fail.
+ *
+ * @param [in] path name of the file
+ * \return true if the file may be an image, false otherwise
+ *****************************************************************************/
+
+bool is_image_file(const std::string& path)
+{
+	if (other_extension(path))
+		return (false);
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return (false);
+
+	unsigned char b[16];			//!< First bytes of the file
+	in.read(reinterpret_cast<char*>(b), sizeof(b));
+	return (image_magic(b, static_cast<size_t>(in.gcount())));
+}
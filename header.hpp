@@ -0,0 +1,5 @@
+#pragma once
+
+bool image_size(const unsigned char* data, size_t n, int& cols, int& rows);
+bool image_size(const std::string& path, int& cols, int& rows);
+bool is_image_file(const std::string& path);
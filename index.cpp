@@ -0,0 +1,388 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "dir.hpp"
+#include "index.hpp"
+
+static const char magic[4] = { 'I', 'B', 'X', '1' };	//!< Identifies an index file
+
+/******************************************************************************
+ * \brief Reader of the fields of an index file, with bounds checks
+ *****************************************************************************/
+
+struct IndexReader
+{
+	const std::vector<char>& data;	//!< Contents of the index file
+	size_t pos;						//!< Offset of the next field
+	bool ok;						//!< Cleared when a field runs past the end
+
+	template <typename T> T get()
+	{
+		T value = T();
+		if (pos + sizeof(T) > data.size())
+			ok = false;
+		else
+			memcpy(&value, &data[pos], sizeof(T));
+		pos += sizeof(T);
+		return (value);
+	}
+
+	std::string get_string()
+	{
+		uint32_t length = get<uint32_t>();
+		if (!ok || pos + length > data.size())
+		{
+			ok = false;
+			return (std::string());
+		}
+		pos += length;
+		return (std::string(&data[pos - length], length));
+	}
+};
+
+/******************************************************************************
+ * \brief Append a field to the contents of an index file
+ *
+ * @param [in,out] out contents of the index file
+ * @param [in] value field to append
+ *****************************************************************************/
+
+template <typename T> static void put(std::string& out, T value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/******************************************************************************
+ * \brief Append a string to the contents of an index file
+ *
+ * @param [in,out] out contents of the index file
+ * @param [in] str string to append, preceded by its length
+ *****************************************************************************/
+
+static void put_string(std::string& out, const std::string& str)
+{
+	put(out, static_cast<uint32_t>(str.size()));
+	out += str;
+}
+
+/******************************************************************************
+ * \brief Use the specified index file
+ *
+ * The file is read when a scan starts and written when it completes.
+ *
+ * @param [in] file name of the index file
+ *****************************************************************************/
+
+DirIndex::DirIndex(const std::string& file) :
+	file(file)
+{
+}
+
+/******************************************************************************
+ * \brief Read the index of a directory tree
+ *
+ * After the magic number comes the name of the top directory, then its node.
+ * A node holds the modification time of its directory and the number of its
+ * entries, followed by the entries, each with its kind and name, and then the
+ * node of a subdirectory or the size and modification time of a file.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [out] root node of the top directory
+ * \return true if the index was read, false if there is none for dirname or
+ *         it is damaged
+ *****************************************************************************/
+
+bool DirIndex::load(const std::string& dirname, Node& root) const
+{
+	std::ifstream in(file, std::ios::binary);
+	if (!in)
+		return (false);
+
+	std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (data.size() < sizeof(magic) || !std::equal(magic, magic + sizeof(magic), data.begin()))
+		return (false);
+
+	IndexReader r = { data, sizeof(magic), true };
+	if (r.get_string() != dirname || !r.ok)
+		return (false);
+
+	// Read the nodes depth first, keeping the nodes not complete yet on a
+	// stack along with the number of entries still to read for each.
+
+	std::vector<std::pair<Node*, uint32_t>> stack;	//!< Nodes being read
+	root.mtime = r.get<int64_t>();
+	stack.emplace_back(&root, r.get<uint32_t>());
+
+	while (r.ok && !stack.empty())
+	{
+		if (stack.back().second == 0)
+		{
+			stack.pop_back();
+			continue;
+		}
+		stack.back().second--;
+
+		Entry e;
+		e.kind = static_cast<Kind>(r.get<uint8_t>());
+		e.name = r.get_string();
+		e.size = 0;
+		e.mtime = 0;
+		if (e.kind == subdir)
+		{
+			e.dir.reset(new Node);
+			e.dir->mtime = r.get<int64_t>();
+			uint32_t n = r.get<uint32_t>();
+			Node* child = e.dir.get();
+			stack.back().first->entries.push_back(std::move(e));
+			stack.emplace_back(child, n);
+		}
+		else if (e.kind == other || e.kind == passed)
+		{
+			e.size = r.get<uint64_t>();
+			e.mtime = r.get<int64_t>();
+			stack.back().first->entries.push_back(std::move(e));
+		}
+		else
+		{
+			r.ok = false;
+		}
+	}
+
+	return (r.ok && r.pos == data.size());
+}
+
+/******************************************************************************
+ * \brief Write the index of a directory tree
+ *
+ * The index is written under a temporary name and renamed into place, so
+ * that a run interrupted while writing never leaves a partial index behind.
+ * Errors are ignored; the next scan simply reads the whole tree again.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [in] root node of the top directory
+ *****************************************************************************/
+
+void DirIndex::save(const std::string& dirname, const Node& root) const
+{
+	std::string out(magic, sizeof(magic));	//!< Contents of the index file
+	put_string(out, dirname);
+
+	std::function<void(const Node&)> put_node = [&out, &put_node](const Node& node) {
+		put(out, node.mtime);
+		put(out, static_cast<uint32_t>(node.entries.size()));
+		for (const auto& e : node.entries)
+		{
+			put(out, static_cast<uint8_t>(e.kind));
+			put_string(out, e.name);
+			if (e.kind == subdir)
+			{
+				put_node(*e.dir);
+			}
+			else
+			{
+				put(out, e.size);
+				put(out, e.mtime);
+			}
+		}
+	};
+	put_node(root);
+
+	replace_file(file, [&out](std::ostream& f) { f.write(out.data(), out.size()); });
+}
+
+/******************************************************************************
+ * \brief List a directory against the index
+ *
+ * Reuse the entries of a directory from the index if its modification time
+ * has not changed, and read it again otherwise, reusing the kind of files
+ * whose size and modification time have not changed.  A file written over
+ * in place leaves the time of its directory alone, so the files that failed
+ * the filter are put to it again even in a directory that has not changed,
+ * in case they have become images since; the filter turns down most of them,
+ * such as sidecar files, by name alone.  Files that were not
+ * in the index are not stat'ed unless their size and time are asked for.
+ * Either way, hand out the files that passed the filter and the
+ * subdirectories, in the order the directory lists them, with the node of
+ * each subdirectory as its tag.  A directory modified within a second of the
+ * start of the scan may be modified again within the same second, so it is
+ * marked to be read again next time.  Called from the scanning threads, each
+ * directory by one thread.  Throws an exception if the directory cannot be
+ * opened.
+ *
+ * @param [in] path name of the directory
+ * @param [in] tag node of the directory as found, with its node in the
+ *             index, if any
+ * @param [in] entry function called with each subdirectory and file passed
+ *****************************************************************************/
+
+void DirIndex::list(const std::string& path, void* tag, const DirLister::Entry& entry)
+{
+#ifdef _WIN32
+	const std::string sep = "\\";
+#else
+	const std::string sep = "/";
+#endif
+
+	Node& node = *static_cast<Node*>(tag);	//!< Node of the directory as found
+	const Node* old = node.old;				//!< Node of the directory in the index, or NULL
+
+	struct stat buf;
+	if (stat(path.c_str(), &buf) != 0)
+		throw (std::string("Unknown directory ") + path);
+	int64_t mtime = static_cast<int64_t>(buf.st_mtime);
+	node.mtime = mtime >= started - 1 ? -1 : mtime;
+
+	if (old && old->mtime != -1 && old->mtime == mtime)
+	{
+		for (const auto& e : old->entries)
+		{
+			if (cancel && *cancel)
+				return;
+
+			std::string name = path + sep + e.name;
+			Entry copy;
+			copy.name = e.name;
+			copy.kind = e.kind;
+			copy.size = e.size;
+			copy.mtime = e.mtime;
+			if (e.kind == subdir)
+			{
+				copy.dir.reset(new Node);
+				copy.dir->old = e.dir.get();
+				entry(name, true, copy.dir.get());
+			}
+			else
+			{
+				if (e.kind == other && (!filter || filter(name)))
+				{
+					struct stat fbuf;
+					copy.kind = passed;
+					if (stat(name.c_str(), &fbuf) == 0)
+					{
+						copy.size = static_cast<uint64_t>(fbuf.st_size);
+						copy.mtime = static_cast<int64_t>(fbuf.st_mtime);
+					}
+				}
+				if (copy.kind == passed)
+				{
+					if (info)
+						info(name, copy.size, copy.mtime);
+					entry(name, false, nullptr);
+				}
+			}
+			node.entries.push_back(std::move(copy));
+		}
+		return;
+	}
+
+	std::unordered_map<std::string, const Entry*> before;	//!< Entries in the index by name
+	if (old)
+	{
+		for (const auto& e : old->entries)
+			before[e.name] = &e;
+	}
+
+	read_dir(path, [this, &path, &sep, &before, &node, &entry](const std::string& file_name,
+															   bool isdir) {
+		if (cancel && *cancel)
+			return;
+
+		Entry e;
+		e.name = file_name.substr(path.size() + sep.size());
+		e.size = 0;
+		e.mtime = 0;
+
+		auto found = before.find(e.name);
+		const Entry* prev = found == before.end() ? nullptr : found->second;
+
+		if (isdir)
+		{
+			e.kind = subdir;
+			e.dir.reset(new Node);
+			if (prev && prev->kind == subdir)
+				e.dir->old = prev->dir.get();
+			entry(file_name, true, e.dir.get());
+		}
+		else
+		{
+			struct stat fbuf;
+			bool known = (prev || info) && stat(file_name.c_str(), &fbuf) == 0;	//!< Set if
+												//   the size and time were found
+			if (known)
+			{
+				e.size = static_cast<uint64_t>(fbuf.st_size);
+				e.mtime = static_cast<int64_t>(fbuf.st_mtime);
+			}
+			if (known && prev && prev->kind != subdir && prev->size == e.size &&
+				prev->mtime == e.mtime)
+				e.kind = prev->kind;
+			else
+				e.kind = !filter || filter(file_name) ? passed : other;
+			if (e.kind == passed)
+			{
+				if (info)
+					info(file_name, e.size, e.mtime);
+				entry(file_name, false, nullptr);
+			}
+		}
+		node.entries.push_back(std::move(e));
+	});
+}
+
+/******************************************************************************
+ * \brief Visit the files of a directory tree, using and updating the index
+ *
+ * Call visit with the name of each file in the tree that passes the filter,
+ * in depth-first order, as parallel_scan() does, and info, if given, with
+ * its size and modification time before.  The directories are listed by
+ * nthreads threads.  The index is written again when the scan completes,
+ * but not when it is cancelled or fails.  Throws an exception if a directory
+ * cannot be opened.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [in] visit function called with the name of each file
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ * @param [in] filter function returning true for the files to visit, or
+ *             nullptr to visit all files
+ * @param [in] cancel flag set to stop the scan early, or NULL
+ * @param [in] info function called with the size and modification time of
+ *             each file visited, or nullptr; it is called from the scanning
+ *             threads in parallel
+ * @param [in] enter function called with each directory before it is
+ *             listed, whether it is read or not, or nullptr
+ *****************************************************************************/
+
+void DirIndex::scan(const std::string& dirname,
+					const std::function<void(const std::string&)>& visit, int nthreads,
+					const std::function<bool(const std::string&)>& filter,
+					const std::atomic<bool>* cancel,
+					const std::function<void(const std::string&, uint64_t, int64_t)>& info,
+					const std::function<void(const std::string&)>& enter)
+{
+	this->filter = filter;
+	this->cancel = cancel;
+	this->info = info;
+	started = static_cast<int64_t>(time(nullptr));
+
+	Node old;							//!< Tree as found by the last scan
+	bool indexed = load(dirname, old);
+
+	Node root;							//!< Tree as found now
+	root.old = indexed ? &old : nullptr;
+	parallel_scan(dirname, visit, nthreads, *this, &root, cancel, enter);
+
+	if (!(cancel && *cancel))
+		save(dirname, root);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/******************************************************************************
+ * \brief Index of a directory tree kept on disk from one run to the next
+ *
+ * The index records every directory of the tree with its modification time,
+ * and its entries in the order the directory lists them: subdirectories, and
+ * files with their size, modification time, and whether they passed the
+ * filter.  A scan with the index stats each directory, and reuses the entries
+ * of those whose modification time has not changed, so that only directories
+ * where files were added, removed, or renamed are read again.  The filter is
+ * only run again on files that are new or have changed since the index was
+ * made, and on files that failed it, which may have been written over in
+ * place without changing their directory.
+ * The size and modification time of the files passed are handed out with
+ * them, so that sorting by either needs no stat of its own.
+ * A tree that has not changed thus costs one stat per directory instead of
+ * reading every directory and the first bytes of every file.  The scan runs
+ * on the threads of parallel_scan(), with the index as its lister, so a tree
+ * with no index yet, or with many directories changed, is read as fast as
+ * without one; files in the directories read are only stat'ed when they
+ * were in the index, to tell whether they changed, or when their size and
+ * time are asked for.
+ *****************************************************************************/
+
+class DirIndex : private DirLister
+{
+public:
+	explicit DirIndex(const std::string& file);
+
+	void scan(const std::string& dirname,
+			  const std::function<void(const std::string&)>& visit, int nthreads,
+			  const std::function<bool(const std::string&)>& filter = nullptr,
+			  const std::atomic<bool>* cancel = nullptr,
+			  const std::function<void(const std::string&, uint64_t, int64_t)>& info = nullptr,
+			  const std::function<void(const std::string&)>& enter = nullptr);
+
+private:
+	//!< Kind of an entry in a directory
+	enum Kind : uint8_t { other, passed, subdir };
+
+	struct Node;
+
+	//!< Entry in a directory
+	struct Entry
+	{
+		std::string name;			//!< Name of the entry within the directory
+		Kind kind;					//!< Kind of the entry
+		uint64_t size;				//!< Size of the file
+		int64_t mtime;				//!< Modification time of the file
+		std::unique_ptr<Node> dir;	//!< Contents of the subdirectory
+	};
+
+	//!< Directory in the tree
+	struct Node
+	{
+		int64_t mtime;				//!< Modification time, or -1 to read it again
+		std::vector<Entry> entries;	//!< Entries in the order listed
+		const Node* old = nullptr;	//!< Node of the directory in the index, during a scan
+	};
+
+	bool load(const std::string& dirname, Node& root) const;
+	void save(const std::string& dirname, const Node& root) const;
+	void list(const std::string& dirname, void* tag, const DirLister::Entry& entry) override;
+
+	std::string file;				//!< Name of the index file
+	std::function<bool(const std::string&)> filter;	//!< Function deciding the files passed
+	std::function<void(const std::string&, uint64_t, int64_t)> info;	//!< Function given the size and time of each file passed
+	const std::atomic<bool>* cancel = nullptr;	//!< Set to stop the scan early, or NULL
+	int64_t started = 0;			//!< Time the scan started
+};
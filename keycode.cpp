@@ -0,0 +1,46 @@
+#include <opencv2/core.hpp>
+#include <opencv2/highgui.hpp>
+#include "keycode.hpp"
+
+/******************************************************************************
+ * \brief Wait for a key and return a code independent of the GUI backend
+ *
+ * cv::waitKeyEx returns the raw key code of the backend, which differs for
+ * the arrow and page keys between GTK, Qt, Cocoa, and Win32.  Those are
+ * mapped to SpecialKey codes.  Other keys are returned as their character,
+ * without any modifier bits.
+ *
+ * @param [in] delay time to wait in ms, or 0 to wait for ever
+ * \return key code, or -1 if no key was pressed in time
+ *****************************************************************************/
+
+int read_key(int delay)
+{
+	//!< Backend codes of special keys: GTK, Qt, Cocoa, Win32
+	static const struct { int code[4]; int key; } special[] =
+	{
+		{ { 0xFF51, 0x1000012, 0xF702, 0x250000 }, KEY_LEFT },
+		{ { 0xFF52, 0x1000013, 0xF700, 0x260000 }, KEY_UP },
+		{ { 0xFF53, 0x1000014, 0xF703, 0x270000 }, KEY_RIGHT },
+		{ { 0xFF54, 0x1000015, 0xF701, 0x280000 }, KEY_DOWN },
+		{ { 0xFF50, 0x1000010, 0xF729, 0x240000 }, KEY_HOME },
+		{ { 0xFF57, 0x1000011, 0xF72B, 0x230000 }, KEY_END },
+		{ { 0xFF55, 0x1000016, 0xF72C, 0x210000 }, KEY_PAGE_UP },
+		{ { 0xFF56, 0x1000017, 0xF72D, 0x220000 }, KEY_PAGE_DOWN },
+	};
+
+	int code = cv::waitKeyEx(delay);
+	if (code < 0)
+		return (-1);
+
+	// GTK and Cocoa codes may come with modifier bits above the low 16 bits
+
+	for (const auto& s : special)
+	{
+		if ((code & 0xFFFF) == s.code[0] || code == s.code[1] ||
+			(code & 0xFFFF) == s.code[2] || code == s.code[3])
+			return (s.key);
+	}
+
+	return (code & 0xFF);
+}
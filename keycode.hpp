@@ -0,0 +1,16 @@
+#pragma once
+
+//!< Codes returned by read_key() for keys that have no character
+enum SpecialKey
+{
+	KEY_LEFT = 0x10000,
+	KEY_UP,
+	KEY_RIGHT,
+	KEY_DOWN,
+	KEY_HOME,
+	KEY_END,
+	KEY_PAGE_UP,
+	KEY_PAGE_DOWN
+};
+
+int read_key(int delay = 0);
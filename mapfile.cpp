@@ -0,0 +1,252 @@
+#include <atomic>
+#include <climits>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "mapfile.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <stdlib.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#elif defined(__APPLE__)
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+#endif
+
+static std::atomic<bool> map_wanted(true);	//!< Set to map files on local file systems
+
+/******************************************************************************
+ * \brief Choose whether files on local file systems are mapped
+ *
+ * Files are mapped unless told otherwise.  Files being written to while they
+ * are read, as in a tree being watched, should not be mapped.
+ *
+ * @param [in] map true to map files, false to read them into a buffer
+ *****************************************************************************/
+
+void map_files(bool map)
+{
+	map_wanted = map;
+}
+
+#ifdef _WIN32
+
+/******************************************************************************
+ * \brief Find out if a file is on a network drive
+ *
+ * @param [in] path name of the file
+ * \return true if the file is on a network share or a mapped network drive
+ *****************************************************************************/
+
+static bool remote(const std::string& path)
+{
+	char full[_MAX_PATH];
+	if (_fullpath(full, path.c_str(), sizeof(full)) == NULL)
+		return (true);
+	if (full[0] == '\\' && full[1] == '\\')
+		return (true);
+	char root[4] = { full[0], ':', '\\', 0 };
+	return (GetDriveTypeA(root) == DRIVE_REMOTE);
+}
+
+#else
+
+/******************************************************************************
+ * \brief Find out if an open file is on a network file system
+ *
+ * In Linux, NFS, SMB, CIFS, 9P, AFS, Ceph, and FUSE file systems count as
+ * network file systems, FUSE since it hosts most of the others.
+ *
+ * @param [in] fd descriptor of the open file
+ * \return true if the file may be changed by another machine
+ *****************************************************************************/
+
+static bool remote(int fd)
+{
+	struct statfs fs;
+	if (fstatfs(fd, &fs) != 0)
+		return (true);
+#ifdef __linux__
+	switch (static_cast<unsigned long>(fs.f_type))
+	{
+	case 0x6969:				// NFS
+	case 0x517B:				// SMB
+	case 0xFF534D42:			// CIFS
+	case 0xFE534D42:			// SMB2
+	case 0x01021997:			// 9P
+	case 0x5346414F:			// AFS
+	case 0x00C36400:			// Ceph
+	case 0x65735546:			// FUSE
+		return (true);
+	default:
+		return (false);
+	}
+#elif defined(__APPLE__)
+	return (!(fs.f_flags & MNT_LOCAL));
+#else
+	return (false);
+#endif
+}
+
+#endif
+
+/******************************************************************************
+ * \brief Map a file into memory, or read it into a buffer
+ *
+ * The file is mapped for sequential reading, since decoders go through
+ * the bytes from start to end.  Files on network file systems, and all files
+ * if mapping is turned off, are read into a buffer from the pool instead,
+ * except for those too big for a cv::Mat.
+ *
+ * @param [in] path name of the file to map
+ * \sa map_files()
+ *****************************************************************************/
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+							  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		if (size.QuadPart <= INT_MAX && (!map_wanted || remote(path)))
+		{
+			copy = new cv::Mat(1, static_cast<int>(size.QuadPart), CV_8UC1);
+			DWORD n;
+			while (length < static_cast<size_t>(size.QuadPart) &&
+				   ReadFile(file, copy->data + length,
+							static_cast<DWORD>(static_cast<size_t>(size.QuadPart) - length), &n,
+							NULL) && n > 0)
+				length += n;
+			if (length)
+				bytes = copy->data;
+		}
+		else
+		{
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping)
+			{
+				bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ,
+																		0, 0, 0));
+				if (bytes)
+					length = static_cast<size_t>(size.QuadPart);
+			}
+		}
+	}
+	CloseHandle(file);				// The mapping keeps the file open
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat buf;
+	if (fstat(fd, &buf) == 0 && buf.st_size > 0)
+	{
+		size_t size = static_cast<size_t>(buf.st_size);	//!< Size of the file when opened
+		if (size <= static_cast<size_t>(INT_MAX) && (!map_wanted || remote(fd)))
+		{
+			copy = new cv::Mat(1, static_cast<int>(size), CV_8UC1);
+			ssize_t n;
+			while (length < size &&
+				   (n = pread(fd, copy->data + length, size - length,
+							  static_cast<off_t>(length))) > 0)
+				length += static_cast<size_t>(n);
+			if (length)
+				bytes = copy->data;
+		}
+		else
+		{
+			void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED)
+			{
+				bytes = static_cast<const unsigned char*>(p);
+				length = size;
+				madvise(p, length, MADV_SEQUENTIAL);
+			}
+		}
+	}
+	close(fd);						// The mapping keeps the file open
+#endif
+}
+
+/******************************************************************************
+ * \brief Unmap the file, or hand its buffer back to the pool
+ *****************************************************************************/
+
+MappedFile::~MappedFile()
+{
+	if (copy)
+	{
+		delete copy;
+		return;
+	}
+#ifdef _WIN32
+	if (bytes)
+		UnmapViewOfFile(bytes);
+	if (mapping)
+		CloseHandle(mapping);
+#else
+	if (bytes)
+		munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+}
+
+/******************************************************************************
+ * \brief Read a file into the page cache
+ *
+ * The file is read through a buffer that is thrown away, so that it is in
+ * memory by the time it is mapped and decoded.  Unlike a hint to the
+ * operating system, the read is over when the call returns, which lets the
+ * caller measure it, and it works the same on every file system, including
+ * network file systems that read ahead little on a hint.
+ *
+ * @param [in] path name of the file
+ * \return number of bytes read
+ *****************************************************************************/
+
+size_t readahead_file(const std::string& path)
+{
+	static const size_t chunk = 1 << 20;	//!< Bytes read at a time
+	static thread_local std::vector<char> buffer(chunk);	//!< Buffer the file is read through
+
+	size_t total = 0;			//!< Bytes read so far
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+							  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return (0);
+
+	DWORD n;
+	while (ReadFile(file, buffer.data(), static_cast<DWORD>(chunk), &n, NULL) && n > 0)
+		total += n;
+	CloseHandle(file);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return (0);
+
+#ifdef __linux__
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	ssize_t n;
+	while ((n = read(fd, buffer.data(), chunk)) > 0)
+		total += static_cast<size_t>(n);
+	close(fd);
+#endif
+
+	return (total);
+}
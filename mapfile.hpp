@@ -0,0 +1,43 @@
+#pragma once
+
+namespace cv { class Mat; }
+
+/******************************************************************************
+ * \brief Read-only memory mapping of a whole file
+ *
+ * Mapping a file lets the decoder read the bytes straight from the page cache
+ * with no copy into a buffer of our own.  The mapping is removed when the
+ * object is destroyed.  If the file cannot be opened or mapped, or is empty,
+ * data() returns NULL.
+ *
+ * A file truncated by another process while it is mapped faults on the pages
+ * past its new end, which kills the program.  Files on network file systems
+ * may be changed by other machines at any time, and so may files in trees
+ * being watched, so those are read whole with one read into a buffer from
+ * the pool instead, and so are all files once map_files(false) is called.  A
+ * file cut short while it is read just gives fewer bytes.
+ *****************************************************************************/
+
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char* data() const { return (bytes); }
+	size_t size() const { return (length); }
+
+private:
+	const unsigned char* bytes = nullptr;	//!< Start of the mapping
+	size_t length = 0;						//!< Size of the file
+	cv::Mat* copy = nullptr;				//!< Buffer the file was read into, if not mapped
+#ifdef _WIN32
+	void* mapping = nullptr;				//!< Handle of the file mapping object
+#endif
+};
+
+void map_files(bool map);
+size_t readahead_file(const std::string& path);
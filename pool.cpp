@@ -0,0 +1,229 @@
+#include <opencv2/core.hpp>
+#include "governor.hpp"
+#include "pool.hpp"
+
+static const size_t min_pooled = 1 << 20;	//!< Smallest buffer kept in the pool
+
+/******************************************************************************
+ * \brief Create the pool and make it the default allocator
+ *
+ * The pool is created once and never destroyed, since images allocated from
+ * it may be freed as late as the exit of the program.  The pool enrolls with
+ * the memory governor as the first consumer to shed.  Later calls return the
+ * same pool.
+ *
+ * @param [in] budget maximum number of bytes kept in free buffers
+ * \return the pool
+ *****************************************************************************/
+
+FramePool& FramePool::install(size_t budget)
+{
+	static FramePool* pool = [budget]() {
+		FramePool* p = new FramePool(budget);
+		MemoryGovernor::enroll(p, 0);
+		return (p);
+	}();
+	cv::Mat::setDefaultAllocator(pool);
+	return (*pool);
+}
+
+/******************************************************************************
+ * \brief Create an empty pool
+ *
+ * @param [in] budget maximum number of bytes kept in free buffers
+ *****************************************************************************/
+
+FramePool::FramePool(size_t budget) :
+	budget(budget)
+{
+}
+
+/******************************************************************************
+ * \brief Round a buffer size up to its size class
+ *
+ * Each power of two is split into four classes, so no more than a quarter of
+ * a buffer is wasted.
+ *
+ * @param [in] size number of bytes requested, at least min_pooled
+ * \return number of bytes in buffers of the class
+ *****************************************************************************/
+
+size_t FramePool::size_class(size_t size)
+{
+	size_t top = 1;					//!< Largest power of two not above size
+	while (top <= size / 2)
+		top <<= 1;
+
+	size_t quarter = top / 4;
+	return ((size + quarter - 1) / quarter * quarter);
+}
+
+/******************************************************************************
+ * \brief Allocate the pixel buffer of a new matrix
+ *
+ * Mirrors OpenCV's own allocator: fill in the steps, and wrap the user
+ * buffer if one is given or allocate one otherwise.  Buffers of min_pooled
+ * bytes or more are taken from the free list of their size class if it is
+ * not empty.
+ *
+ * @param [in] dims number of dimensions
+ * @param [in] sizes size of each dimension
+ * @param [in] type type of the elements
+ * @param [in] data buffer supplied by the user, or NULL
+ * @param [in,out] step step of each dimension
+ * @param [in] flags access flags, unused
+ * @param [in] usage usage flags, unused
+ * \return data describing the buffer
+ *****************************************************************************/
+
+cv::UMatData* FramePool::allocate(int dims, const int* sizes, int type, void* data,
+								  size_t* step, cv::AccessFlag /*flags*/,
+								  cv::UMatUsageFlags /*usage*/) const
+{
+	size_t total = CV_ELEM_SIZE(type);	//!< Number of bytes in the buffer
+	for (int i = dims - 1; i >= 0; i--)
+	{
+		if (step)
+		{
+			if (data && step[i] != CV_AUTOSTEP)
+			{
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else
+			{
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	uchar* buffer = static_cast<uchar*>(data);
+	if (!buffer && total >= min_pooled)
+	{
+		size_t size = size_class(total);
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto it = buffers.find(size);
+			if (it != buffers.end() && !it->second.empty())
+			{
+				buffer = static_cast<uchar*>(it->second.back());
+				it->second.pop_back();
+				spare -= size;
+			}
+		}
+		if (!buffer)
+			buffer = static_cast<uchar*>(cv::fastMalloc(size));
+	}
+	else if (!buffer)
+	{
+		buffer = static_cast<uchar*>(cv::fastMalloc(total));
+	}
+
+	cv::UMatData* u = new cv::UMatData(this);
+	u->data = u->origdata = buffer;
+	u->size = total;
+	if (data)
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+
+	return (u);
+}
+
+/******************************************************************************
+ * \brief Allocate the device copy of a buffer
+ *
+ * There is no device copy for host memory, so there is nothing to do.
+ *
+ * \return true if u is not NULL
+ *****************************************************************************/
+
+bool FramePool::allocate(cv::UMatData* u, cv::AccessFlag /*flags*/,
+						 cv::UMatUsageFlags /*usage*/) const
+{
+	return (u != NULL);
+}
+
+/******************************************************************************
+ * \brief Free the pixel buffer of a matrix
+ *
+ * Buffers of min_pooled bytes or more go back to the free list of their size
+ * class, unless that would take the free buffers over budget.  User buffers
+ * are left alone.  The memory governor is not called from here, since the
+ * frames it evicts are freed here while it holds its lock; rather, it sheds
+ * the pool again once those buffers have landed in it.
+ *
+ * @param [in] u data describing the buffer
+ *****************************************************************************/
+
+void FramePool::deallocate(cv::UMatData* u) const
+{
+	if (!u)
+		return;
+
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+
+	if (!(u->flags & cv::UMatData::USER_ALLOCATED))
+	{
+		bool kept = false;				//!< Set if the buffer went to a free list
+		if (u->size >= min_pooled)
+		{
+			size_t size = size_class(u->size);
+			std::lock_guard<std::mutex> guard(lock);
+			if (spare + size <= budget)
+			{
+				buffers[size].push_back(u->origdata);
+				spare += size;
+				kept = true;
+			}
+		}
+		if (!kept)
+			cv::fastFree(u->origdata);
+		u->origdata = 0;
+	}
+
+	delete u;
+}
+
+/******************************************************************************
+ * \brief Find the memory held in free buffers
+ *
+ * \return number of bytes in free buffers
+ *****************************************************************************/
+
+size_t FramePool::held() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (spare);
+}
+
+/******************************************************************************
+ * \brief Release free buffers for the memory governor
+ *
+ * The largest buffers go first, so that few are released.
+ *
+ * @param [in] bytes number of bytes to release
+ * \return number of bytes released
+ *****************************************************************************/
+
+size_t FramePool::shed(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	size_t released = 0;				//!< Number of bytes released so far
+
+	while (released < bytes && !buffers.empty())
+	{
+		auto it = std::prev(buffers.end());
+		if (!it->second.empty())
+		{
+			cv::fastFree(it->second.back());
+			it->second.pop_back();
+			spare -= it->first;
+			released += it->first;
+		}
+		if (it->second.empty())
+			buffers.erase(it);
+	}
+
+	return (released);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+/******************************************************************************
+ * \brief Allocator recycling the pixel buffers of large images
+ *
+ * Every image decoded and scaled allocates buffers of a few sizes over and
+ * over, tens of megabytes each for full-resolution images.  Handing those
+ * back to malloc after every image costs page faults on the next allocation
+ * and fragments the heap over a long session.  The pool keeps freed buffers
+ * of 1 MB and more in free lists by size class, four classes per power of
+ * two, and hands them out again for the next request of the same class.
+ * Smaller buffers go straight to OpenCV's own allocator.  Free buffers are
+ * kept up to a budget in bytes; past that, buffers are released.  The free
+ * buffers are the first memory the memory governor sheds.
+ *
+ * The pool is installed as the default allocator for all cv::Mat, so that
+ * images created inside cv::imdecode and cv::resize come from it too.  All
+ * functions can be called from any thread.
+ *****************************************************************************/
+
+class FramePool : public cv::MatAllocator, public MemoryGovernor::Consumer
+{
+public:
+	static FramePool& install(size_t budget);
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+						   size_t* step, cv::AccessFlag flags,
+						   cv::UMatUsageFlags usage) const CV_OVERRIDE;
+	bool allocate(cv::UMatData* u, cv::AccessFlag flags,
+				  cv::UMatUsageFlags usage) const CV_OVERRIDE;
+	void deallocate(cv::UMatData* u) const CV_OVERRIDE;
+
+	size_t held() const override;
+	size_t shed(size_t bytes) override;
+
+private:
+	explicit FramePool(size_t budget);
+
+	static size_t size_class(size_t size);
+
+	size_t budget;						//!< Maximum number of bytes in free buffers
+	mutable size_t spare = 0;			//!< Number of bytes in free buffers
+	mutable std::map<size_t, std::vector<void*>> buffers;	//!< Free buffers by size class
+	mutable std::mutex lock;			//!< Protects spare and buffers
+};
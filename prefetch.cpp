@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "frame.hpp"
+#include "governor.hpp"
+#include "cache.hpp"
+#include "diskcache.hpp"
+#include "dir.hpp"
+#include "filelist.hpp"
+#include "mapfile.hpp"
+#include "stats.hpp"
+#include "readahead.hpp"
+#include "prefetch.hpp"
+
+/******************************************************************************
+ * \brief Start the prefetcher
+ *
+ * Start a pool of worker threads, one per core but no more than the number of
+ * frames that can be waiting in the ring, and the I/O threads reading the
+ * files ahead unless readahead is 0.
+ *
+ * @param [in] ahead number of files to decode after the current one
+ * @param [in] behind number of files to decode before the current one
+ * @param [in] readahead number of files to read ahead after those decoded
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [in] cache cache to look up frames in before decoding them
+ * @param [in] disk disk cache to look up frames in before decoding them, or
+ *             NULL if there is none
+ *****************************************************************************/
+
+Prefetcher::Prefetcher(int ahead, int behind, int readahead, int maxrows, int maxcols,
+					   FrameCache& cache, DiskCache* disk) :
+	ahead(std::max(ahead, 0)), behind(std::max(behind, 0)), readahead(std::max(readahead, 0)),
+	maxrows(maxrows), maxcols(maxcols), cache(cache), disk(disk)
+{
+	int nthreads = std::min(static_cast<int>(std::thread::hardware_concurrency()),
+							this->ahead + this->behind);
+	if (this->readahead > 0)
+		io.reset(new ReadAhead);
+
+	for (int t = 0; t < nthreads; t++)
+		workers.emplace_back(&Prefetcher::worker, this);
+}
+
+/******************************************************************************
+ * \brief Stop the prefetcher
+ *
+ * Tell the workers to exit and wait for them.  A worker in the middle of a
+ * decode finishes that decode first.
+ *****************************************************************************/
+
+Prefetcher::~Prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	work.notify_all();
+
+	for (auto& t : workers)
+		t.join();
+}
+
+/******************************************************************************
+ * \brief Find the slot holding the specified file
+ *
+ * Must be called with lock held.
+ *
+ * @param [in] path name of the file
+ * \return iterator to the slot, or ring.end() if the file is not in the ring
+ *****************************************************************************/
+
+std::list<Prefetcher::Slot>::iterator Prefetcher::find(const std::string& path)
+{
+	return (std::find_if(ring.begin(), ring.end(),
+						 [&path](const Slot& s) { return s.path == path; }));
+}
+
+/******************************************************************************
+ * \brief Load the frame for the specified file
+ *
+ * Look up the frame in the memory cache, then in the disk cache, and decode
+ * the file only if it is in neither.  Frames are added to the caches they
+ * were missing from.  Frames cached without hashes do not count when hashes
+ * are wanted.  The time each load takes is kept with the frame, and the hits
+ * and misses of each cache are counted.  Called without lock held.
+ *
+ * @param [in] path name of the file
+ * \return frame ready to be displayed
+ *****************************************************************************/
+
+Frame Prefetcher::load(const std::string& path)
+{
+	Frame frame;				//!< Frame to be returned
+	bool hashed = hashes_used();	//!< Set if frames must carry their hashes
+
+	if (cache.get(path, maxrows, maxcols, frame) && (!hashed || frame.digest))
+	{
+		Stats::add(Counter::cache_hit);
+		return (frame);
+	}
+	Stats::add(Counter::cache_miss);
+
+	auto start = std::chrono::steady_clock::now();	//!< Time the load started
+	auto elapsed = [&start]() {
+		return (std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+														 start).count());
+	};
+
+	if (disk)
+	{
+		if (disk->get(path, maxrows, maxcols, frame) && (!hashed || frame.digest))
+		{
+			Stats::add(Counter::disk_hit);
+			Stats::reached(Milestone::first_load);
+			frame.cost = elapsed();
+			cache.put(path, maxrows, maxcols, frame);
+			return (frame);
+		}
+		Stats::add(Counter::disk_miss);
+	}
+
+	frame = load_frame(path, maxrows, maxcols);
+	Stats::reached(Milestone::first_load);
+	frame.cost = elapsed();
+	cache.put(path, maxrows, maxcols, frame);
+	if (disk)
+		disk->put(path, maxrows, maxcols, frame);
+
+	return (frame);
+}
+
+/******************************************************************************
+ * \brief Move the prefetch window to the specified position
+ *
+ * Queue the current file and the files around it for decoding, the current
+ * file and the span - 1 files after it first, then alternately the files
+ * after and before those until ahead more files after and behind files
+ * before are queued.  The readahead files after those are queued to be read
+ * into the page cache.  Frames that fall outside the window are dropped from
+ * the ring, so the ring never holds more than ahead + behind + span frames
+ * plus those being decoded at the moment.  Files dropped from the list do not
+ * count, and files the scan has not found yet are left out of the window.
+ * The files queued, and then the readahead files, are handed to the I/O
+ * threads to be read in that order.
+ *
+ * @param [in] files list of files being browsed
+ * @param [in] i index of the file being displayed
+ * @param [in] span number of files displayed at once, starting with i
+ *****************************************************************************/
+
+void Prefetcher::position(const FileList& files, size_t i, int span)
+{
+	std::vector<std::string> wanted;	//!< Files in the window, in priority order
+	size_t n = files.size();			//!< Number of files found so far
+
+	size_t next = i;					//!< Last file taken after the current one
+	size_t prev = i;					//!< Last file taken before the current one
+
+	wanted.push_back(files[i]);
+	for (int k = 1; k < span; k++)
+	{
+		while (++next < n && files.dropped(next))
+			;
+		if (next < n)
+			wanted.push_back(files[next]);
+	}
+
+	for (int k = 1; k <= std::max(ahead, behind); k++)
+	{
+		if (k <= ahead)
+		{
+			while (++next < n && files.dropped(next))
+				;
+			if (next < n)
+				wanted.push_back(files[next]);
+		}
+		if (k <= behind && prev > 0)
+		{
+			while (--prev > 0 && files.dropped(prev))
+				;
+			if (!files.dropped(prev))
+				wanted.push_back(files[prev]);
+		}
+	}
+
+	std::vector<std::string> upcoming;	//!< Files to read ahead
+	while (upcoming.size() < static_cast<size_t>(readahead))
+	{
+		while (++next < n && files.dropped(next))
+			;
+		if (next >= n)
+			break;
+		upcoming.push_back(files[next]);
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	// Drop the frames outside the window.  Slots being decoded are left for
+	// the worker to pick up; the worker drops the frame if nobody wants it.
+
+	ring.remove_if([&wanted](const Slot& s) {
+		return (s.state != State::loading &&
+				std::find(wanted.begin(), wanted.end(), s.path) == wanted.end());
+	});
+
+	// Queue the files in the window that are not in the ring yet
+
+	queue.clear();
+	for (const auto& path : wanted)
+	{
+		auto slot = find(path);
+		if (slot == ring.end())
+		{
+			ring.push_back(Slot{ path, State::queued, Frame() });
+			queue.push_back(path);
+		}
+		else if (slot->state == State::queued)
+		{
+			queue.push_back(path);
+		}
+	}
+
+	work.notify_all();
+
+	if (io)
+	{
+		std::vector<std::string> reads(queue.begin(), queue.end());	//!< Files to read
+		reads.insert(reads.end(), upcoming.begin(), upcoming.end());
+		io->want(reads);
+	}
+}
+
+/******************************************************************************
+ * \brief Get the frame for the specified file
+ *
+ * Return the frame from the ring if it has already been decoded, wait for it
+ * if a worker is decoding it, and load it on the calling thread otherwise.
+ *
+ * @param [in] path name of the file
+ * \return frame ready to be displayed
+ *****************************************************************************/
+
+Frame Prefetcher::get(const std::string& path)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	auto slot = find(path);
+	if (slot != ring.end() && slot->state == State::loading)
+	{
+		ready.wait(guard, [this, &path]() {
+			auto s = find(path);
+			return (s == ring.end() || s->state != State::loading);
+		});
+		slot = find(path);
+	}
+
+	if (slot != ring.end() && slot->state == State::ready)
+		return (slot->frame);
+
+	// Nobody has started on the file; decode it here rather than wait for a
+	// worker to get around to it.
+
+	if (slot == ring.end())
+		slot = ring.insert(ring.end(), Slot{ path, State::queued, Frame() });
+	slot->state = State::loading;
+	queue.erase(std::remove(queue.begin(), queue.end(), path), queue.end());
+	guard.unlock();
+
+	Frame frame = load(path);
+
+	guard.lock();
+	slot = find(path);
+	if (slot != ring.end())
+	{
+		slot->frame = frame;
+		slot->state = State::ready;
+	}
+	ready.notify_all();
+
+	return (frame);
+}
+
+/******************************************************************************
+ * \brief Get the frame for the specified file if it is ready
+ *
+ * Return the frame from the ring if it has already been decoded, without
+ * waiting for a worker that is still on it.  If there are no workers to
+ * decode the file, or the file is not in the prefetch window, load it on the
+ * calling thread like get() does.
+ *
+ * @param [in] path name of the file
+ * @param [out] frame frame ready to be displayed, if true is returned
+ * \return true if the frame is ready, false if a worker is still on it
+ *****************************************************************************/
+
+bool Prefetcher::poll(const std::string& path, Frame& frame)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		auto slot = find(path);
+		if (slot != ring.end() && slot->state == State::ready)
+		{
+			frame = slot->frame;
+			return (true);
+		}
+		if (slot != ring.end() && !workers.empty())
+			return (false);
+	}
+
+	frame = get(path);
+
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Drop the frames of a file, or of all files in a directory
+ *
+ * Called when files are changed or removed on disk.  Frames being decoded
+ * are left for the worker to finish, since the file may already have been
+ * read; the next position() drops them if they are no longer wanted.
+ *
+ * @param [in] path name of the file or directory
+ *****************************************************************************/
+
+void Prefetcher::forget(const std::string& path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	ring.remove_if([&path](const Slot& s) {
+		return (s.state != State::loading && in_tree(s.path, path));
+	});
+	queue.erase(std::remove_if(queue.begin(), queue.end(),
+							   [&path](const std::string& p) { return (in_tree(p, path)); }),
+				queue.end());
+	if (io)
+		io->forget(path);
+}
+
+/******************************************************************************
+ * \brief Decode files from the queue until told to exit
+ *
+ * Take the file with the highest priority from the queue, decode it without
+ * holding the lock, and store the result in the ring if the file is still in
+ * the prefetch window.
+ *****************************************************************************/
+
+void Prefetcher::worker()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (;;)
+	{
+		work.wait(guard, [this]() { return (done || !queue.empty()); });
+		if (done)
+			return;
+
+		std::string path = queue.front();
+		queue.pop_front();
+
+		auto slot = find(path);
+		if (slot == ring.end() || slot->state != State::queued)
+			continue;
+		slot->state = State::loading;
+		guard.unlock();
+
+		Frame frame = load(path);
+
+		guard.lock();
+		slot = find(path);
+		if (slot != ring.end())
+		{
+			slot->frame = frame;
+			slot->state = State::ready;
+		}
+		ready.notify_all();
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class ReadAhead;
+
+/******************************************************************************
+ * \brief Background decoder for the images around the current one
+ *
+ * The prefetcher keeps a bounded ring of frames for the next few and the
+ * previous few files relative to the image on screen.  A pool of worker
+ * threads decodes and scales those files while the user is looking at the
+ * current image, so that moving to the next or previous image does not wait
+ * for a decode.  Frames are identified by path name, so that removing a file
+ * from the list does not invalidate frames already decoded.  The files
+ * waiting to be decoded, and beyond them the next few files, are read ahead
+ * into the page cache by I/O threads of their own with several reads in
+ * flight, so that reading them overlaps the decodes and the time the user
+ * spends on the current image.  Frames that drop out of the ring remain
+ * available from the frame cache, and frames from earlier runs are read
+ * from the disk cache.
+ *****************************************************************************/
+
+class Prefetcher
+{
+public:
+	Prefetcher(int ahead, int behind, int readahead, int maxrows, int maxcols,
+			   FrameCache& cache, DiskCache* disk);
+	~Prefetcher();
+
+	void position(const FileList& files, size_t i, int span = 1);
+	Frame get(const std::string& path);
+	bool poll(const std::string& path, Frame& frame);
+	void forget(const std::string& path);
+
+private:
+	//!< State of a slot in the ring
+	enum class State { queued, loading, ready };
+
+	//!< Slot in the ring holding one frame
+	struct Slot
+	{
+		std::string path;		//!< Name of the file decoded into this slot
+		State state;			//!< Progress of the decode
+		Frame frame;			//!< Decoded frame, valid if state is ready
+	};
+
+	void worker();
+	Frame load(const std::string& path);
+	std::list<Slot>::iterator find(const std::string& path);
+
+	int ahead;					//!< Number of files to decode after the current one
+	int behind;					//!< Number of files to decode before the current one
+	int readahead;				//!< Number of files to read ahead after those decoded
+	int maxrows;				//!< Maximum number of rows in display window
+	int maxcols;				//!< Maximum number of columns in display window
+	FrameCache& cache;			//!< Frames decoded earlier
+	DiskCache* disk;			//!< Frames decoded in earlier runs, or NULL
+
+	std::list<Slot> ring;		//!< Frames around the current position
+	std::deque<std::string> queue;	//!< Files waiting to be decoded, in priority order
+	std::unique_ptr<ReadAhead> io;	//!< Reader of the files ahead, or NULL if none
+	std::vector<std::thread> workers;	//!< Pool of decoding threads
+	std::mutex lock;			//!< Protects ring, queue, and done
+	std::condition_variable work;	//!< Signalled when queue gets new entries
+	std::condition_variable ready;	//!< Signalled when a frame is decoded
+	bool done = false;			//!< Set when the workers must exit
+};
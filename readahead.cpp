@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "dir.hpp"
+#include "mapfile.hpp"
+#include "readahead.hpp"
+
+static const int max_depth = 16;		//!< Most reads in flight at once
+static const size_t max_recent = 1024;	//!< Number of files read lately remembered
+static const double min_window = 0.1;	//!< Shortest window of reads measured, in seconds
+static const double min_gain = 0.05;	//!< Drop in throughput that turns the depth back
+
+/******************************************************************************
+ * \brief Start the I/O threads
+ *
+ * One thread is started for each read that may be in flight, so that the
+ * depth can change without starting or stopping threads.
+ *****************************************************************************/
+
+ReadAhead::ReadAhead()
+{
+	for (int t = 0; t < max_depth; t++)
+		threads.emplace_back(&ReadAhead::worker, this);
+}
+
+/******************************************************************************
+ * \brief Stop the I/O threads
+ *
+ * Files not read yet are left; reads in flight finish first.
+ *****************************************************************************/
+
+ReadAhead::~ReadAhead()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	work.notify_all();
+
+	for (auto& t : threads)
+		t.join();
+}
+
+/******************************************************************************
+ * \brief Set the files to read next
+ *
+ * The files replace those still waiting, so that files the user has moved
+ * away from are not read.  Files read lately are left out.
+ *
+ * @param [in] paths files to read, in priority order
+ *****************************************************************************/
+
+void ReadAhead::want(const std::vector<std::string>& paths)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pending.clear();
+		for (const auto& path : paths)
+		{
+			if (!seen.count(path))
+				pending.push_back(path);
+		}
+	}
+	work.notify_all();
+}
+
+/******************************************************************************
+ * \brief Forget a file, or all files in a directory
+ *
+ * Called when files are changed or removed on disk, so that a file changed
+ * is read again when it is next wanted.
+ *
+ * @param [in] path name of the file or directory
+ *****************************************************************************/
+
+void ReadAhead::forget(const std::string& path)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	auto under = [&path](const std::string& p) { return (in_tree(p, path)); };
+	pending.erase(std::remove_if(pending.begin(), pending.end(), under), pending.end());
+	recent.erase(std::remove_if(recent.begin(), recent.end(), under), recent.end());
+	for (auto it = seen.begin(); it != seen.end(); )
+		it = under(*it) ? seen.erase(it) : std::next(it);
+}
+
+/******************************************************************************
+ * \brief Get the number of reads that may be in flight
+ *
+ * \return current depth
+ *****************************************************************************/
+
+int ReadAhead::depth() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return (limit);
+}
+
+/******************************************************************************
+ * \brief Account for a read that completed, and tune the depth
+ *
+ * Must be called with lock held.  A window ends after twice as many reads as
+ * the depth and at least min_window seconds.  If throughput dropped against
+ * the last window, the last change of depth did not pay, and the depth
+ * changes the other way; otherwise it keeps going the same way.
+ *
+ * @param [in] bytes number of bytes read
+ *****************************************************************************/
+
+void ReadAhead::measure(size_t bytes)
+{
+	window_bytes += bytes;
+	window_files++;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+												   window_start).count();
+	if (window_files < 2 * limit || seconds < min_window)
+		return;
+
+	double rate = window_bytes / seconds;	//!< Bytes per second in this window
+	if (rate < last_rate * (1 - min_gain))
+		direction = -direction;
+	limit = std::min(std::max(limit + direction, 1), max_depth);
+	if (limit == 1 || limit == max_depth)
+		direction = limit == 1 ? 1 : -1;
+	last_rate = rate;
+
+	window_bytes = 0;
+	window_files = 0;
+	window_start = std::chrono::steady_clock::now();
+}
+
+/******************************************************************************
+ * \brief Read files until told to exit
+ *
+ * A read started while no other is in flight starts a new window, since the
+ * time the reader sat idle says nothing about the depth.
+ *****************************************************************************/
+
+void ReadAhead::worker()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (;;)
+	{
+		work.wait(guard, [this]() { return (done || (!pending.empty() && active < limit)); });
+		if (done)
+			return;
+
+		std::string path = pending.front();
+		pending.pop_front();
+		if (seen.count(path))
+			continue;
+
+		seen.insert(path);
+		recent.push_back(path);
+		if (recent.size() > max_recent)
+		{
+			seen.erase(recent.front());
+			recent.pop_front();
+		}
+
+		if (active == 0)
+		{
+			window_bytes = 0;
+			window_files = 0;
+			window_start = std::chrono::steady_clock::now();
+		}
+		active++;
+		guard.unlock();
+
+		size_t bytes = readahead_file(path);
+
+		guard.lock();
+		active--;
+		measure(bytes);
+		work.notify_all();
+	}
+}
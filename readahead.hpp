@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+/******************************************************************************
+ * \brief Reader keeping several files in flight into the page cache
+ *
+ * A pool of I/O threads reads the files asked for ahead of their decode, so
+ * that on network file systems several requests are outstanding at once
+ * instead of one per decode.  The number of reads in flight, the depth, is
+ * tuned as the reads go: the throughput over each window of reads is
+ * compared with that of the window before, and the depth keeps moving the
+ * same way while throughput improves and turns back when it drops.  Local
+ * disks, where an extra read only adds contention, thus settle at a low
+ * depth and high-latency mounts at a high one.  Files read recently are not
+ * read again.  All functions can be called from any thread.
+ *****************************************************************************/
+
+class ReadAhead
+{
+public:
+	ReadAhead();
+	~ReadAhead();
+
+	void want(const std::vector<std::string>& paths);
+	void forget(const std::string& path);
+	int depth() const;
+
+private:
+	void worker();
+	void measure(size_t bytes);
+
+	std::deque<std::string> pending;	//!< Files waiting to be read, in priority order
+	std::deque<std::string> recent;		//!< Files read lately, oldest first
+	std::unordered_set<std::string> seen;	//!< Files in recent
+	std::vector<std::thread> threads;	//!< Pool of I/O threads
+	int limit = 2;						//!< Most reads in flight at once
+	int active = 0;						//!< Reads in flight
+	int direction = 1;					//!< Change of limit after the next window
+	double last_rate = 0;				//!< Bytes per second in the last window
+	size_t window_bytes = 0;			//!< Bytes read in the current window
+	int window_files = 0;				//!< Files read in the current window
+	std::chrono::steady_clock::time_point window_start;	//!< Start of the current window
+	mutable std::mutex lock;			//!< Protects all of the above and done
+	std::condition_variable work;		//!< Signalled when files or room to read them come up
+	bool done = false;					//!< Set when the threads must exit
+};
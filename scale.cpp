@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <opencv2/opencv_modules.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/imgproc.hpp>
+#ifdef HAVE_OPENCV_CUDAWARPING
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudawarping.hpp>
+#endif
+#include "scale.hpp"
+
+static std::atomic<int> backend(static_cast<int>(Backend::cpu));	//!< Device scaling images
+static const size_t gpu_pixels = 1 << 21;	//!< Smallest image worth sending to the GPU
+
+/******************************************************************************
+ * \brief Find the backend of the specified name
+ *
+ * Throws an exception if the name is unknown.
+ *
+ * @param [in] name name of the backend: cpu, opencl, or cuda
+ * \return backend
+ *****************************************************************************/
+
+Backend parse_backend(const std::string& name)
+{
+	if (name == "cpu")
+		return (Backend::cpu);
+	if (name == "opencl")
+		return (Backend::opencl);
+	if (name == "cuda")
+		return (Backend::cuda);
+	throw (std::string("Unknown backend ") + name);
+}
+
+/******************************************************************************
+ * \brief Get the name of a backend
+ *
+ * @param [in] backend backend
+ * \return name of the backend
+ *****************************************************************************/
+
+const char* backend_name(Backend backend)
+{
+	switch (backend)
+	{
+	case Backend::opencl:
+		return ("opencl");
+	case Backend::cuda:
+		return ("cuda");
+	default:
+		return ("cpu");
+	}
+}
+
+/******************************************************************************
+ * \brief Choose the device that scales images
+ *
+ * CUDA is only available if OpenCV was built with its CUDA modules and a CUDA
+ * device is present, and OpenCL if OpenCV finds an OpenCL device.  A backend
+ * that is not available falls back to the CPU.
+ *
+ * @param [in] wanted backend asked for
+ * \return backend in use
+ *****************************************************************************/
+
+Backend use_backend(Backend wanted)
+{
+	Backend got = Backend::cpu;
+
+#ifdef HAVE_OPENCV_CUDAWARPING
+	if (wanted == Backend::cuda && cv::cuda::getCudaEnabledDeviceCount() > 0)
+		got = Backend::cuda;
+#endif
+	if (wanted == Backend::opencl && cv::ocl::haveOpenCL())
+	{
+		cv::ocl::setUseOpenCL(true);
+		got = cv::ocl::useOpenCL() ? Backend::opencl : Backend::cpu;
+	}
+
+	backend = static_cast<int>(got);
+	return (got);
+}
+
+/******************************************************************************
+ * \brief Resample an image on the GPU
+ *
+ * The image is uploaded, resampled in one pass, and downloaded into a new
+ * image in main memory, since frames are kept in the caches.  Throws
+ * cv::Exception if the device fails.
+ *
+ * @param [in] img image to be scaled
+ * @param [out] image scaled image
+ * @param [in] size size of the scaled image
+ * @param [in] interpolation interpolation method
+ * @param [in] device backend to use, opencl or cuda
+ *****************************************************************************/
+
+static void gpu_resize(const cv::Mat& img, cv::Mat& image, cv::Size size, int interpolation,
+					   Backend device)
+{
+#ifdef HAVE_OPENCV_CUDAWARPING
+	if (device == Backend::cuda)
+	{
+		static thread_local cv::cuda::GpuMat src, dst;	//!< Device buffers, reused across calls
+		src.upload(img);
+		cv::cuda::resize(src, dst, size, 0, 0, interpolation);
+		dst.download(image);
+		return;
+	}
+#else
+	(void)device;
+#endif
+
+	// Copy into a UMat of its own rather than map the pixels in place, since
+	// they may come from the frame pool rather than the OpenCL allocator.
+
+	cv::UMat src, dst;
+	img.copyTo(src);
+	cv::resize(src, dst, size, 0, 0, interpolation);
+	dst.copyTo(image);
+}
+
+/******************************************************************************
+ * \brief Scale an image to fit the display window
+ *
+ * Compute the ratio that makes the image fit in a window of maxrows x maxcols
+ * while maintaining its aspect ratio, and resample the image to that size.
+ *
+ * Small reductions and enlargements use bilinear interpolation.  Reductions
+ * by half or more average each block of source pixels with an area filter so
+ * that fine detail does not alias.  Such reductions are done in two steps:
+ * first by the integer factor k = floor(1/ratio), for which OpenCV averages
+ * k x k blocks in one vectorized pass, and then by the remaining factor
+ * between 1/2 and 1 on the much smaller intermediate image.  The
+ * intermediate image is kept from one call to the next on each thread so that
+ * it is not reallocated for every image, while the scaled image is always
+ * newly allocated because frames are kept in the caches after display.
+ *
+ * With a GPU backend, large images are resampled on the GPU in one pass
+ * instead; small ones cost more to upload than to scale on the CPU.  If the
+ * device fails, scaling falls back to the CPU for good.
+ *
+ * @param [in] img image to be scaled
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * \return scaled image
+ *****************************************************************************/
+
+cv::Mat scale_to_fit(const cv::Mat& img, int maxrows, int maxcols)
+{
+	float ratio = 1.0;			//!< Downsampling ratio
+
+	// Find out the dominant dimension from rows and columns.  This needs to be
+	// determined to find out whether the image is to be scaled by rows or
+	// Columns.
+
+	float ratio1 = static_cast<float>(maxcols) / img.cols;
+	float ratio2 = static_cast<float>(maxrows) / img.rows;
+	ratio = ratio1 < ratio2 ? ratio1 : ratio2;
+
+	// Since the aspect ratio is to be preserved, the same ratio is used to
+	// multiply rows and columns to find the size of the scaled image.
+
+	cv::Size size(std::max(static_cast<int>( ratio * img.cols ), 1),
+				  std::max(static_cast<int>( ratio * img.rows ), 1));
+	cv::Mat image;				//!< Scaled image
+
+	Backend device = static_cast<Backend>(backend.load());	//!< Device to scale on
+	if (device != Backend::cpu && img.total() >= gpu_pixels)
+	{
+		try
+		{
+			gpu_resize(img, image, size, ratio > 0.5f ? cv::INTER_LINEAR : cv::INTER_AREA, device);
+			return (image);
+		}
+		catch (cv::Exception&)
+		{
+			backend = static_cast<int>(Backend::cpu);
+		}
+	}
+
+	if (ratio > 0.5f)
+	{
+		cv::resize(img, image, size, 0, 0, cv::INTER_LINEAR);
+		return (image);
+	}
+
+	// Reduce by the integer factor first.  The source is cropped to a
+	// multiple of the factor, losing less than k pixels at the right and
+	// bottom edges, so that OpenCV takes its fast path for integer factors.
+
+	static thread_local cv::Mat reduced;	//!< Intermediate image, reused across calls
+
+	int k = static_cast<int>(1.0f / ratio);	//!< Integer reduction factor
+	cv::Size ksize(img.cols / k, img.rows / k);
+
+	if (ksize.width == 0 || ksize.height == 0)
+	{
+		cv::resize(img, image, size, 0, 0, cv::INTER_AREA);
+		return (image);
+	}
+
+	cv::Mat src = img(cv::Rect(0, 0, ksize.width * k, ksize.height * k));
+
+	if (ksize == size)
+	{
+		cv::resize(src, image, size, 0, 0, cv::INTER_AREA);
+		return (image);
+	}
+
+	cv::resize(src, reduced, ksize, 0, 0, cv::INTER_AREA);
+	cv::resize(reduced, image, size, 0, 0, cv::INTER_AREA);
+
+	return (image);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+//!< Device that scales images
+enum class Backend { cpu, opencl, cuda };
+
+cv::Mat scale_to_fit(const cv::Mat& img, int maxrows, int maxcols);
+Backend parse_backend(const std::string& name);
+Backend use_backend(Backend wanted);
+const char* backend_name(Backend backend);
@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dir.hpp"
+#include "exif.hpp"
+#include "sort.hpp"
+
+static const size_t date_bytes = 1 << 17;	//!< Bytes read from each file to find its date
+
+/******************************************************************************
+ * \brief Find the sort order of the specified name
+ *
+ * Throws an exception if the name is unknown.
+ *
+ * @param [in] name name of the order: name, natural, mtime, size, or exif-date
+ * \return order of the files
+ *****************************************************************************/
+
+SortKey parse_sort(const std::string& name)
+{
+	if (name == "name")
+		return (SortKey::name);
+	if (name == "natural")
+		return (SortKey::natural);
+	if (name == "mtime")
+		return (SortKey::mtime);
+	if (name == "size")
+		return (SortKey::size);
+	if (name == "exif-date")
+		return (SortKey::exif_date);
+	throw (std::string("Unknown sort order ") + name);
+}
+
+/******************************************************************************
+ * \brief Find out if an order needs the size and modification time of files
+ *
+ * The date taken falls back on the modification time for files without one.
+ *
+ * @param [in] key order of the files
+ * \return true if the files must be stat'ed as they are found
+ *****************************************************************************/
+
+bool needs_stat(SortKey key)
+{
+	return (key == SortKey::mtime || key == SortKey::size || key == SortKey::exif_date);
+}
+
+/******************************************************************************
+ * \brief Split a path name into a key for natural order
+ *
+ * The key is made once per file, so that comparing two files is a plain
+ * comparison of their keys.  Letters are folded to lower case and path
+ * separators become NUL characters, so that the files of a directory come
+ * before those of the directories whose name it is a prefix of.  Each run of
+ * digits becomes a byte below any printable character giving the number of
+ * significant digits, followed by those digits, so that a shorter number
+ * comes before a longer one and numbers of the same length compare digit by
+ * digit.  Numbers that differ only in leading zeros get the same key.
+ *
+ * @param [in] path name of the file
+ * \return key of the file
+ *****************************************************************************/
+
+std::string natural_key(const std::string& path)
+{
+	std::string key;				//!< Key being built
+	key.reserve(path.size() + 4);
+
+	for (size_t i = 0; i < path.size(); )
+	{
+		unsigned char c = static_cast<unsigned char>(path[i]);
+		if (isdigit(c))
+		{
+			while (i < path.size() && path[i] == '0')
+				i++;
+			size_t start = i;
+			while (i < path.size() && isdigit(static_cast<unsigned char>(path[i])))
+				i++;
+			key += static_cast<char>(1 + std::min<size_t>(i - start, 30));
+			key.append(path, start, i - start);
+		}
+		else
+		{
+			key += c == '/' || c == '\\' ? '\0' : static_cast<char>(tolower(c));
+			i++;
+		}
+	}
+
+	return (key);
+}
+
+/******************************************************************************
+ * \brief Convert an EXIF date to a number that sorts the same way
+ *
+ * @param [in] date date as YYYY:MM:DD HH:MM:SS
+ * \return date as YYYYMMDDhhmmss, or 0 if it is not a valid date
+ *****************************************************************************/
+
+static int64_t exif_date(const std::string& date)
+{
+	int64_t value = 0;
+	int digits = 0;
+	for (char c : date)
+	{
+		if (isdigit(static_cast<unsigned char>(c)) && digits < 14)
+		{
+			value = value * 10 + (c - '0');
+			digits++;
+		}
+	}
+	return (digits == 14 && value >= 10000000000000LL ? value : 0);
+}
+
+/******************************************************************************
+ * \brief Find the date each file was taken
+ *
+ * The first bytes of each file are read for the EXIF date, on nthreads
+ * threads since the reads are independent.  Files with no EXIF date get
+ * their modification time, in local time like EXIF dates, so that photos
+ * and other images still sort together.
+ *
+ * @param [in,out] entries files to find the dates of
+ * @param [in] nthreads number of threads to use, or 0 for one per core
+ *****************************************************************************/
+
+void read_dates(std::vector<SortEntry>& entries, int nthreads)
+{
+	if (nthreads <= 0)
+		nthreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+	std::atomic<size_t> next(0);	//!< Next entry to be read
+
+	auto reader = [&entries, &next]() {
+		std::vector<char> head(date_bytes);
+		for (size_t i; (i = next++) < entries.size(); )
+		{
+			std::ifstream in(entries[i].path, std::ios::binary);
+			in.read(head.data(), head.size());
+			ExifInfo info;
+			if (read_exif(reinterpret_cast<const unsigned char*>(head.data()),
+						  static_cast<size_t>(in.gcount()), info))
+				entries[i].date = exif_date(info.date);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nthreads; t++)
+		threads.emplace_back(reader);
+	reader();
+	for (auto& t : threads)
+		t.join();
+
+	for (auto& e : entries)
+	{
+		time_t mtime = static_cast<time_t>(e.mtime);
+		struct tm* local;
+		if (e.date == 0 && e.mtime != 0 && (local = localtime(&mtime)) != nullptr)
+			e.date = (local->tm_year + 1900) * 10000000000LL + (local->tm_mon + 1) * 100000000LL +
+					 local->tm_mday * 1000000LL + local->tm_hour * 10000 +
+					 local->tm_min * 100 + local->tm_sec;
+	}
+}
+
+/******************************************************************************
+ * \brief Sort files in the specified order
+ *
+ * Files that compare equal are ordered by path name, so that the order is
+ * the same from one run to the next.  Natural order keys are made once for
+ * each file before sorting.  With no order, the files are left as they are.
+ *
+ * @param [in,out] entries files to sort
+ * @param [in] key order of the files
+ *****************************************************************************/
+
+void sort_files(std::vector<SortEntry>& entries, SortKey key)
+{
+	auto by_path = [](const SortEntry& a, const SortEntry& b) { return (a.path < b.path); };
+
+	switch (key)
+	{
+	case SortKey::none:
+		break;
+
+	case SortKey::name:
+		std::sort(entries.begin(), entries.end(), by_path);
+		break;
+
+	case SortKey::natural:
+	{
+		std::vector<std::pair<std::string, size_t>> keys;	//!< Key and position of each file
+		keys.reserve(entries.size());
+		for (size_t i = 0; i < entries.size(); i++)
+			keys.emplace_back(natural_key(entries[i].path), i);
+		std::sort(keys.begin(), keys.end(), [&entries](const std::pair<std::string, size_t>& a,
+													   const std::pair<std::string, size_t>& b) {
+			int c = a.first.compare(b.first);
+			return (c != 0 ? c < 0 : entries[a.second].path < entries[b.second].path);
+		});
+
+		std::vector<SortEntry> sorted;
+		sorted.reserve(entries.size());
+		for (const auto& k : keys)
+			sorted.push_back(std::move(entries[k.second]));
+		entries.swap(sorted);
+		break;
+	}
+
+	case SortKey::mtime:
+		std::sort(entries.begin(), entries.end(), [](const SortEntry& a, const SortEntry& b) {
+			return (a.mtime != b.mtime ? a.mtime < b.mtime : a.path < b.path);
+		});
+		break;
+
+	case SortKey::size:
+		std::sort(entries.begin(), entries.end(), [](const SortEntry& a, const SortEntry& b) {
+			return (a.size != b.size ? a.size < b.size : a.path < b.path);
+		});
+		break;
+
+	case SortKey::exif_date:
+		std::sort(entries.begin(), entries.end(), [](const SortEntry& a, const SortEntry& b) {
+			return (a.date != b.date ? a.date < b.date : a.path < b.path);
+		});
+		break;
+	}
+}
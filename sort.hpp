@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//!< File to be sorted, with the metadata it may be sorted by
+struct SortEntry
+{
+	std::string path;			//!< Name of the file
+	uint64_t size = 0;			//!< Size of the file
+	int64_t mtime = 0;			//!< Modification time of the file, or 0 if unknown
+	int64_t date = 0;			//!< Local time taken as YYYYMMDDhhmmss, or 0 if unknown
+};
+
+SortKey parse_sort(const std::string& name);
+bool needs_stat(SortKey key);
+std::string natural_key(const std::string& path);
+void read_dates(std::vector<SortEntry>& entries, int nthreads);
+void sort_files(std::vector<SortEntry>& entries, SortKey key);
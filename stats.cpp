@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "stats.hpp"
+
+static const size_t max_outliers = 10;		//!< Number of slowest samples kept per stage
+static const double min_ms = 0.001;			//!< Upper bound of the first bucket of samples
+static const int per_octave = 8;			//!< Buckets of samples per doubling of the time
+static const int nbuckets = 28 * per_octave;	//!< Buckets of samples, up to about 4.5 minutes
+
+static const char* const stage_names[] = { "scan", "read", "decode", "scale", "encode", "show",
+											 "key" };
+
+static const char* const counter_names[] = { "cache_hit", "cache_miss", "disk_hit", "disk_miss",
+											   "evicted", "evicted_bytes", "pressure" };
+
+static const char* const milestone_names[] = { "window", "first_file", "first_load",
+												 "first_frame" };
+
+//!< Samples of one stage
+struct StageStats
+{
+	uint64_t buckets[nbuckets] = {};	//!< Number of samples in each bucket of time
+	uint64_t n = 0;						//!< Number of samples
+	double max = 0;						//!< Longest sample in milliseconds
+	std::vector<std::pair<double, std::string>> slowest;	//!< Slowest samples, slowest first
+};
+
+static std::atomic<bool> on(false);		//!< Set when samples are to be recorded
+static std::mutex lock;					//!< Protects stages
+static StageStats stages[static_cast<int>(Stage::count)];	//!< Samples by stage
+static std::atomic<uint64_t> counters[static_cast<int>(Counter::count)];	//!< Events counted
+static std::atomic<int64_t> milestones[static_cast<int>(Milestone::count)];	//!< Microseconds
+												//   from launch to each milestone, or 0
+static const std::chrono::steady_clock::time_point launched = std::chrono::steady_clock::now();
+												//!< Time the program started
+
+/******************************************************************************
+ * \brief Start recording samples
+ *****************************************************************************/
+
+void Stats::enable()
+{
+	on = true;
+}
+
+/******************************************************************************
+ * \brief Find whether samples are recorded
+ *
+ * \return true if samples are recorded, false otherwise
+ *****************************************************************************/
+
+bool Stats::enabled()
+{
+	return (on);
+}
+
+/******************************************************************************
+ * \brief Find the bucket of a sample
+ *
+ * Bucket b holds the samples up to min_ms * 2^(b / per_octave) milliseconds
+ * and longer than those of bucket b - 1, so the buckets are about 9% wide
+ * whatever the time.  The last bucket holds every sample longer too.
+ *
+ * @param [in] ms sample in milliseconds
+ * \return the bucket
+ *****************************************************************************/
+
+static int bucket(double ms)
+{
+	if (ms <= min_ms)
+		return (0);
+	double b = std::ceil(std::log2(ms / min_ms) * per_octave);
+	return (b >= nbuckets - 1 ? nbuckets - 1 : static_cast<int>(b));
+}
+
+/******************************************************************************
+ * \brief Add a sample to a stage
+ *
+ * Only the number of samples in each bucket of time is kept, so the
+ * statistics take the same memory however long the program runs.  The
+ * sample is also kept with its file if it is among the slowest of its stage.
+ *
+ * @param [in] stage stage timed
+ * @param [in] ms time spent in the stage in milliseconds
+ * @param [in] path file the stage worked on, or the empty string
+ *****************************************************************************/
+
+void Stats::record(Stage stage, double ms, const std::string& path)
+{
+	if (!on)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	StageStats& s = stages[static_cast<int>(stage)];
+
+	s.buckets[bucket(ms)]++;
+	s.n++;
+	s.max = std::max(s.max, ms);
+
+	if (s.slowest.size() < max_outliers || ms > s.slowest.back().first)
+	{
+		auto pos = std::find_if(s.slowest.begin(), s.slowest.end(),
+								[ms](const std::pair<double, std::string>& o) { return o.first < ms; });
+		s.slowest.insert(pos, std::make_pair(ms, path));
+		if (s.slowest.size() > max_outliers)
+			s.slowest.pop_back();
+	}
+}
+
+/******************************************************************************
+ * \brief Count events
+ *
+ * @param [in] counter kind of event
+ * @param [in] n number of events, or of bytes for evicted_bytes
+ *****************************************************************************/
+
+void Stats::add(Counter counter, uint64_t n)
+{
+	if (on)
+		counters[static_cast<int>(counter)] += n;
+}
+
+/******************************************************************************
+ * \brief Record the time from launch to a milestone
+ *
+ * Only the first time each milestone is reached counts.
+ *
+ * @param [in] milestone milestone reached
+ *****************************************************************************/
+
+void Stats::reached(Milestone milestone)
+{
+	if (!on)
+		return;
+
+	int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - launched).count();
+	int64_t none = 0;
+	milestones[static_cast<int>(milestone)].compare_exchange_strong(none, std::max(us,
+																			static_cast<int64_t>(1)));
+}
+
+/******************************************************************************
+ * \brief Find a percentile of the samples of a stage
+ *
+ * Use the nearest rank, and give the middle of the bucket that sample is in
+ * on a log scale, or the longest sample if that is shorter, so that the
+ * result is within about 4.5% of the sample.
+ *
+ * @param [in] s samples of the stage, at least one
+ * @param [in] p percentile wanted, as a fraction
+ * \return the percentile
+ *****************************************************************************/
+
+static double percentile(const StageStats& s, double p)
+{
+	uint64_t rank = std::max(static_cast<uint64_t>(std::ceil(p * s.n)), static_cast<uint64_t>(1));
+	uint64_t seen = 0;					//!< Number of samples in the buckets so far
+	int b = 0;							//!< Bucket of the sample of that rank
+	while (b < nbuckets - 1 && (seen += s.buckets[b]) < rank)
+		b++;
+	double mid = b ? min_ms * std::exp2((b - 0.5) / per_octave) : min_ms;	//!< Middle of the bucket
+	return (std::min(mid, s.max));
+}
+
+/******************************************************************************
+ * \brief Quote a string for JSON
+ *
+ * @param [in] str string to quote
+ * \return the string in double quotes, with special characters escaped
+ *****************************************************************************/
+
+static std::string json_string(const std::string& str)
+{
+	std::string quoted = "\"";			//!< String to be returned
+
+	for (unsigned char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			quoted += '\\';
+			quoted += c;
+		}
+		else if (c < 0x20)
+		{
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			quoted += esc;
+		}
+		else
+			quoted += c;
+	}
+
+	return (quoted + "\"");
+}
+
+/******************************************************************************
+ * \brief Quote a string for CSV
+ *
+ * @param [in] str string to quote
+ * \return the string in double quotes, with double quotes doubled
+ *****************************************************************************/
+
+static std::string csv_string(const std::string& str)
+{
+	std::string quoted = "\"";			//!< String to be returned
+
+	for (char c : str)
+	{
+		if (c == '"')
+			quoted += '"';
+		quoted += c;
+	}
+
+	return (quoted + "\"");
+}
+
+/******************************************************************************
+ * \brief Write the statistics
+ *
+ * Write a table to stderr if dest is empty or "true", which is what a bare
+ * --stats gives.  Otherwise write to the file dest, as JSON if its name ends
+ * in .json and as CSV otherwise.  In CSV, each stage takes one line with an
+ * empty path, followed by one line for each of its slowest samples with the
+ * sample in all columns, each counter takes one line with its value as the
+ * count, and each milestone reached takes one line with its time from launch
+ * in all columns.
+ *
+ * @param [in] dest name of the file to write, or empty for stderr
+ *****************************************************************************/
+
+void Stats::report(const std::string& dest)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	std::ostringstream out;				//!< Report being written
+	bool json = dest.size() >= 5 && dest.compare(dest.size() - 5, 5, ".json") == 0;
+	bool table = dest.empty() || dest == "true";
+
+	out << std::fixed << std::setprecision(3);
+	if (table)
+		out << std::left << std::setw(8) << "stage" << std::right << std::setw(8) << "count"
+			<< std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "p99 ms"
+			<< std::setw(10) << "max ms" << "\n";
+	else if (json)
+		out << "{\n";
+	else
+		out << "stage,count,p50_ms,p95_ms,p99_ms,max_ms,path\n";
+
+	bool first = true;					//!< Set until the first stage is written
+	for (int k = 0; k < static_cast<int>(Stage::count); k++)
+	{
+		StageStats& s = stages[k];
+		if (s.n == 0)
+			continue;
+
+		uint64_t n = s.n;
+		double p50 = percentile(s, 0.50);
+		double p95 = percentile(s, 0.95);
+		double p99 = percentile(s, 0.99);
+		double max = s.max;
+
+		if (table)
+		{
+			out << std::left << std::setw(8) << stage_names[k] << std::right << std::setw(8) << n
+				<< std::setw(10) << p50 << std::setw(10) << p95 << std::setw(10) << p99
+				<< std::setw(10) << max << "\n";
+		}
+		else if (json)
+		{
+			out << (first ? "" : ",\n") << "  " << json_string(stage_names[k]) << ": { \"count\": "
+				<< n << ", \"p50_ms\": " << p50 << ", \"p95_ms\": " << p95 << ", \"p99_ms\": "
+				<< p99 << ", \"max_ms\": " << max << ",\n    \"slowest\": [";
+			for (size_t j = 0; j < s.slowest.size(); j++)
+				out << (j ? ", " : "") << "{ \"ms\": " << s.slowest[j].first << ", \"path\": "
+					<< json_string(s.slowest[j].second) << " }";
+			out << "] }";
+		}
+		else
+		{
+			out << stage_names[k] << "," << n << "," << p50 << "," << p95 << "," << p99 << ","
+				<< max << ",\n";
+			for (const auto& o : s.slowest)
+				out << stage_names[k] << ",1," << o.first << "," << o.first << "," << o.first
+					<< "," << o.first << "," << csv_string(o.second) << "\n";
+		}
+		first = false;
+	}
+
+	int ncounters = static_cast<int>(Counter::count);	//!< Number of counters
+	if (table)
+	{
+		out << "\ncounters:\n";
+		for (int k = 0; k < ncounters; k++)
+			out << std::left << std::setw(16) << counter_names[k] << std::right
+				<< std::setw(12) << counters[k] << "\n";
+	}
+	else if (json)
+	{
+		out << (first ? "" : ",\n") << "  \"counters\": { ";
+		for (int k = 0; k < ncounters; k++)
+			out << (k ? ", " : "") << json_string(counter_names[k]) << ": " << counters[k];
+		out << " }";
+	}
+	else
+	{
+		for (int k = 0; k < ncounters; k++)
+			out << counter_names[k] << "," << counters[k] << ",,,,,\n";
+	}
+
+	int nmilestones = static_cast<int>(Milestone::count);	//!< Number of milestones
+	if (table)
+	{
+		out << "\nstartup ms:\n";
+		for (int k = 0; k < nmilestones; k++)
+			if (milestones[k])
+				out << std::left << std::setw(16) << milestone_names[k] << std::right
+					<< std::setw(12) << milestones[k] / 1000.0 << "\n";
+	}
+	else if (json)
+	{
+		out << ",\n  \"startup_ms\": { ";
+		bool any = false;				//!< Set once a milestone is written
+		for (int k = 0; k < nmilestones; k++)
+			if (milestones[k])
+			{
+				out << (any ? ", " : "") << json_string(milestone_names[k]) << ": "
+					<< milestones[k] / 1000.0;
+				any = true;
+			}
+		out << " }";
+	}
+	else
+	{
+		for (int k = 0; k < nmilestones; k++)
+			if (milestones[k])
+			{
+				double ms = milestones[k] / 1000.0;
+				out << milestone_names[k] << ",1," << ms << "," << ms << "," << ms << "," << ms
+					<< ",\n";
+			}
+	}
+
+	if (json)
+		out << "\n}\n";
+
+	if (table)
+	{
+		out << "\nslowest files:\n";
+		for (int k = 0; k < static_cast<int>(Stage::count); k++)
+			for (const auto& o : stages[k].slowest)
+				if (!o.second.empty())
+					out << std::left << std::setw(8) << stage_names[k] << std::right
+						<< std::setw(10) << o.first << "  " << o.second << "\n";
+		std::cerr << out.str();
+		return;
+	}
+
+	std::ofstream file(dest.c_str());
+	file << out.str();
+	if (!file)
+		throw (std::string("Cannot write statistics to ") + dest);
+}
+
+/******************************************************************************
+ * \brief Start timing a stage
+ *
+ * @param [in] stage stage to time
+ * @param [in] path file the stage works on, or the empty string
+ *****************************************************************************/
+
+StageTimer::StageTimer(Stage stage, const std::string& path) :
+	stage(stage), on(Stats::enabled())
+{
+	if (on)
+	{
+		this->path = path;
+		start = std::chrono::steady_clock::now();
+	}
+}
+
+/******************************************************************************
+ * \brief Stop timing the stage and record the time spent in it
+ *****************************************************************************/
+
+StageTimer::~StageTimer()
+{
+	stop();
+}
+
+/******************************************************************************
+ * \brief Stop timing the stage and record the time spent in it
+ *
+ * Nothing more is recorded when the timer goes out of scope.
+ *****************************************************************************/
+
+void StageTimer::stop()
+{
+	if (on)
+		Stats::record(stage, std::chrono::duration<double, std::milli>(
+						  std::chrono::steady_clock::now() - start).count(), path);
+	on = false;
+}
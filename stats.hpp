@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//!< Stages of getting an image on screen that are timed
+enum class Stage
+{
+	scan,					//!< Reading one directory
+	read,					//!< Opening a file and parsing its header
+	decode,					//!< Decoding an image
+	scale,					//!< Scaling an image to fit the window
+	encode,					//!< Encoding and writing an exported image
+	show,					//!< Handing a frame to the window
+	key,					//!< From a key press to the next frame on screen
+	count					//!< Number of stages
+};
+
+//!< Events that are counted
+enum class Counter
+{
+	cache_hit,				//!< Frame found in the memory cache
+	cache_miss,				//!< Frame not in the memory cache
+	disk_hit,				//!< Frame found in the disk cache
+	disk_miss,				//!< Frame not in the disk cache
+	evicted,				//!< Frame evicted from the memory cache
+	evicted_bytes,			//!< Bytes of the frames evicted
+	pressure,				//!< Memory pressure reported by the system
+	count					//!< Number of counters
+};
+
+//!< Points reached once on the way from launch to the first image on screen
+enum class Milestone
+{
+	window,					//!< Display window created
+	first_file,				//!< First file found by the scan
+	first_load,				//!< First frame decoded or read from a cache
+	first_frame,			//!< First frame on screen, rough or not
+	count					//!< Number of milestones
+};
+
+/******************************************************************************
+ * \brief Timings of the stages of getting an image on screen
+ *
+ * When enabled, every stage timed adds a sample to a histogram of its stage
+ * with buckets about 9% wide, so that memory stays the same however many
+ * samples are taken, and the slowest samples of each stage are kept along
+ * with the file they were taken for.  The report gives the number of samples
+ * and the 50th, 95th and 99th percentiles, to within a bucket, and maximum of
+ * each stage in milliseconds, and the slowest files, followed by the counters
+ * of cache hits and misses and of evictions, and by the time from launch to
+ * each startup milestone reached.  When not enabled, timing a stage costs one
+ * test of a flag.  All functions can be called from any thread.
+ *****************************************************************************/
+
+class Stats
+{
+public:
+	static void enable();
+	static bool enabled();
+	static void record(Stage stage, double ms, const std::string& path);
+	static void add(Counter counter, uint64_t n = 1);
+	static void reached(Milestone milestone);
+	static void report(const std::string& dest);
+};
+
+/******************************************************************************
+ * \brief Timer recording the time spent in a scope as a sample of a stage
+ *
+ * The time is recorded when the timer goes out of scope, or earlier when it is
+ * stopped.  The path is copied, and only when the statistics are enabled, so
+ * that a temporary may be passed and timing costs nothing otherwise.
+ *****************************************************************************/
+
+class StageTimer
+{
+public:
+	StageTimer(Stage stage, const std::string& path);
+	~StageTimer();
+
+	void stop();
+
+private:
+	Stage stage;						//!< Stage being timed
+	bool on;							//!< Set if the statistics were enabled at the start
+	std::string path;					//!< File the stage is working on, if on
+	std::chrono::steady_clock::time_point start;	//!< Time the stage started
+};
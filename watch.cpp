@@ -0,0 +1,481 @@
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "dir.hpp"
+#include "watch.hpp"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#elif defined(_WIN32)
+#include <Windows.h>
+#endif
+
+/******************************************************************************
+ * \brief Report every file in a directory tree as added
+ *
+ * Used for directories created or moved into the tree, whose files may have
+ * been written before the directory was watched.  A directory that is gone
+ * again by the time it is read is skipped.
+ *
+ * @param [in] dir name of the directory
+ *****************************************************************************/
+
+void DirWatcher::report_tree(const std::string& dir)
+{
+	try
+	{
+		scan_dir(dir, added);
+	}
+	catch (std::string&)
+	{
+	}
+}
+
+#if defined(__linux__)
+
+/******************************************************************************
+ * \brief Start watching a directory tree
+ *
+ * inotify watches single directories, so every directory in the tree gets a
+ * watch of its own, added by watch_dir() as the scan reaches it.  Throws an
+ * exception if inotify is not available.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [in] added function called with each file added or changed
+ * @param [in] removed function called with each file or directory removed
+ *****************************************************************************/
+
+DirWatcher::DirWatcher(const std::string& dirname, const Callback& added,
+					   const Callback& removed) :
+	dirname(dirname), added(added), removed(removed)
+{
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0 || pipe(wake) != 0)
+	{
+		if (fd >= 0)
+			close(fd);
+		throw (std::string("Cannot watch ") + dirname);
+	}
+
+	thread = std::thread(&DirWatcher::run, this);
+}
+
+/******************************************************************************
+ * \brief Stop watching
+ *
+ * Wake up the thread reading the events and wait for it to exit.
+ *****************************************************************************/
+
+DirWatcher::~DirWatcher()
+{
+	// If the pipe cannot be written to, closing it wakes the thread just the
+	// same, and it must not be closed again.
+
+	char c = 0;
+	if (write(wake[1], &c, 1) != 1)
+	{
+		close(wake[1]);
+		wake[1] = -1;
+	}
+	thread.join();
+
+	close(wake[0]);
+	if (wake[1] >= 0)
+		close(wake[1]);
+	close(fd);
+}
+
+/******************************************************************************
+ * \brief Watch one directory of the tree
+ *
+ * Called by the scanning threads with each directory before they read it, so
+ * that a file written after it is read is reported.  A directory that cannot
+ * be watched, for example because the limit on the number of watches is
+ * reached, is left out.  Watching a directory again does no harm.
+ *
+ * @param [in] dir name of the directory
+ *****************************************************************************/
+
+void DirWatcher::watch_dir(const std::string& dir)
+{
+	int wd = inotify_add_watch(fd, dir.c_str(),
+							   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM |
+							   IN_DELETE | IN_ONLYDIR | IN_DONT_FOLLOW);
+	if (wd < 0)
+		return;
+
+	std::lock_guard<std::mutex> guard(lock);
+	dirs[wd] = dir;
+}
+
+/******************************************************************************
+ * \brief Watch a directory created or moved in, and all directories under it
+ *
+ * A directory that cannot be watched, for example because the limit on the
+ * number of watches is reached, is left out along with its subdirectories,
+ * and so is a directory removed before it is read.
+ *
+ * @param [in] dir name of the directory
+ * @param [in] report true to report the files found as added
+ *****************************************************************************/
+
+void DirWatcher::watch_tree(const std::string& dir, bool report)
+{
+	int wd = inotify_add_watch(fd, dir.c_str(),
+							   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MOVED_FROM |
+							   IN_DELETE | IN_ONLYDIR | IN_DONT_FOLLOW);
+	if (wd < 0)
+		return;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		dirs[wd] = dir;
+	}
+
+	try
+	{
+		read_dir(dir, [this, report](const std::string& file_name, bool subdir) {
+			if (subdir)
+				watch_tree(file_name, report);
+			else if (report)
+				added(file_name);
+		});
+	}
+	catch (std::string&)
+	{
+	}
+}
+
+/******************************************************************************
+ * \brief Stop watching a directory tree that was removed or moved out
+ *
+ * A directory moved elsewhere keeps its watches, which would report files
+ * under names the directory no longer has.  If it was moved within the tree,
+ * it is watched again under its new name.
+ *
+ * @param [in] dir name the directory had
+ *****************************************************************************/
+
+void DirWatcher::forget_tree(const std::string& dir)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto it = dirs.begin(); it != dirs.end(); )
+		{
+			if (in_tree(it->second, dir))
+			{
+				inotify_rm_watch(fd, it->first);
+				it = dirs.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	removed(dir);
+}
+
+/******************************************************************************
+ * \brief Read events until told to stop
+ *
+ * Files are reported when they are closed after writing or moved in, rather
+ * than when they are created, so that they are complete by then.  New
+ * directories are watched and their files reported.
+ *****************************************************************************/
+
+void DirWatcher::run()
+{
+	std::vector<char> buf(64 * 1024);	//!< Events read at once
+
+	for (;;)
+	{
+		struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wake[0], POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0)
+			continue;
+		if (fds[1].revents)
+			return;
+
+		ssize_t n = read(fd, buf.data(), buf.size());
+		for (ssize_t pos = 0; pos < n; )
+		{
+			const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(&buf[pos]);
+			pos += sizeof(struct inotify_event) + ev->len;
+
+			std::string name;			//!< File the event is about
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				auto dir = dirs.find(ev->wd);
+				if (dir == dirs.end())
+					continue;
+				if (ev->mask & IN_IGNORED)
+				{
+					dirs.erase(dir);
+					continue;
+				}
+				if (ev->len == 0)
+					continue;
+				name = dir->second + "/" + ev->name;
+			}
+
+			if (ev->mask & IN_ISDIR)
+			{
+				if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+					watch_tree(name, true);
+				else if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
+					forget_tree(name);
+			}
+			else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+			{
+				added(name);
+			}
+			else if (ev->mask & (IN_MOVED_FROM | IN_DELETE))
+			{
+				removed(name);
+			}
+		}
+	}
+}
+
+#elif defined(__APPLE__)
+
+/******************************************************************************
+ * \brief Start watching a directory tree
+ *
+ * FSEvents watches a whole tree with one stream, and reports absolute names
+ * of files, which are turned back into names under dirname.  Throws an
+ * exception if the stream cannot be created.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [in] added function called with each file added or changed
+ * @param [in] removed function called with each file or directory removed
+ *****************************************************************************/
+
+DirWatcher::DirWatcher(const std::string& dirname, const Callback& added,
+					   const Callback& removed) :
+	dirname(dirname), added(added), removed(removed)
+{
+	char full[PATH_MAX];
+	if (realpath(dirname.c_str(), full) == NULL)
+		throw (std::string("Cannot watch ") + dirname);
+	real = full;
+
+	CFStringRef path = CFStringCreateWithCString(NULL, full, kCFStringEncodingUTF8);
+	CFArrayRef paths = CFArrayCreate(NULL, reinterpret_cast<const void**>(&path), 1,
+									 &kCFTypeArrayCallBacks);
+	FSEventStreamContext context = { 0, this, NULL, NULL, NULL };
+	stream = FSEventStreamCreate(NULL, &DirWatcher::events, &context, paths,
+								 kFSEventStreamEventIdSinceNow, 0.1,
+								 kFSEventStreamCreateFlagFileEvents |
+								 kFSEventStreamCreateFlagNoDefer);
+	CFRelease(paths);
+	CFRelease(path);
+	if (!stream)
+		throw (std::string("Cannot watch ") + dirname);
+
+	queue = dispatch_queue_create("image_browser.watch", DISPATCH_QUEUE_SERIAL);
+	FSEventStreamSetDispatchQueue(stream, queue);
+	FSEventStreamStart(stream);
+}
+
+/******************************************************************************
+ * \brief Stop watching
+ *
+ * Once the stream is invalidated, no more events are delivered.
+ *****************************************************************************/
+
+DirWatcher::~DirWatcher()
+{
+	FSEventStreamStop(stream);
+	FSEventStreamInvalidate(stream);
+	FSEventStreamRelease(stream);
+	dispatch_release(queue);
+}
+
+/******************************************************************************
+ * \brief Watch one directory of the tree
+ *
+ * The stream covers the whole tree, so there is nothing to do.
+ *
+ * @param [in] dir name of the directory
+ *****************************************************************************/
+
+void DirWatcher::watch_dir(const std::string&)
+{
+}
+
+/******************************************************************************
+ * \brief Handle a batch of events
+ *
+ * A renamed item is added if it exists and removed if it does not, since
+ * FSEvents reports both ends of a rename the same way.
+ *
+ * @param [in] stream stream the events came from
+ * @param [in] info watch the stream belongs to
+ * @param [in] n number of events
+ * @param [in] paths absolute names of the files the events are about
+ * @param [in] flags what happened to each file
+ * @param [in] ids identifiers of the events
+ *****************************************************************************/
+
+void DirWatcher::events(ConstFSEventStreamRef stream, void* info, size_t n, void* paths,
+						const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[])
+{
+	DirWatcher* self = static_cast<DirWatcher*>(info);
+	char** names = static_cast<char**>(paths);
+
+	for (size_t k = 0; k < n; k++)
+	{
+		std::string full = names[k];
+		if (!in_tree(full, self->real))
+			continue;
+		std::string name = self->dirname + full.substr(self->real.size());	//!< File under dirname
+
+		struct stat buf;
+		bool exists = lstat(full.c_str(), &buf) == 0;
+		bool isdir = (flags[k] & kFSEventStreamEventFlagItemIsDir) != 0;
+
+		if (!exists)
+		{
+			if (flags[k] & (kFSEventStreamEventFlagItemRemoved | kFSEventStreamEventFlagItemRenamed))
+				self->removed(name);
+		}
+		else if (isdir)
+		{
+			if (flags[k] & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRenamed))
+				self->report_tree(name);
+		}
+		else if (flags[k] & (kFSEventStreamEventFlagItemCreated | kFSEventStreamEventFlagItemRenamed |
+							 kFSEventStreamEventFlagItemModified))
+		{
+			self->added(name);
+		}
+	}
+}
+
+#elif defined(_WIN32)
+
+/******************************************************************************
+ * \brief Start watching a directory tree
+ *
+ * ReadDirectoryChangesW watches a whole tree with one handle.  Throws an
+ * exception if the directory cannot be opened.
+ *
+ * @param [in] dirname name of the top directory
+ * @param [in] added function called with each file added or changed
+ * @param [in] removed function called with each file or directory removed
+ *****************************************************************************/
+
+DirWatcher::DirWatcher(const std::string& dirname, const Callback& added,
+					   const Callback& removed) :
+	dirname(dirname), added(added), removed(removed), stop(false)
+{
+	HANDLE handle = CreateFileA(dirname.c_str(), FILE_LIST_DIRECTORY,
+								FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+								OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		throw (std::string("Cannot watch ") + dirname);
+	dir = handle;
+
+	thread = std::thread(&DirWatcher::run, this);
+}
+
+/******************************************************************************
+ * \brief Stop watching
+ *
+ * Cancel the read the thread is blocked in and wait for it to exit.
+ *****************************************************************************/
+
+DirWatcher::~DirWatcher()
+{
+	// The thread may be about to start a read when it is cancelled, so keep
+	// cancelling until it has exited.
+
+	stop = true;
+	do
+		CancelSynchronousIo(thread.native_handle());
+	while (WaitForSingleObject(thread.native_handle(), 10) == WAIT_TIMEOUT);
+	thread.join();
+	CloseHandle(static_cast<HANDLE>(dir));
+}
+
+/******************************************************************************
+ * \brief Watch one directory of the tree
+ *
+ * The handle covers the whole tree, so there is nothing to do.
+ *
+ * @param [in] dir name of the directory
+ *****************************************************************************/
+
+void DirWatcher::watch_dir(const std::string&)
+{
+}
+
+/******************************************************************************
+ * \brief Read events until told to stop
+ *
+ * Names come in UTF-16 relative to the top directory, and are converted to
+ * the code page the rest of the program uses for file names.
+ *****************************************************************************/
+
+void DirWatcher::run()
+{
+	std::vector<DWORD> buf(16 * 1024);	//!< Events read at once, DWORD aligned
+	DWORD bytes;
+
+	while (!stop && ReadDirectoryChangesW(static_cast<HANDLE>(dir), buf.data(),
+										  static_cast<DWORD>(buf.size() * sizeof(DWORD)), TRUE,
+										  FILE_NOTIFY_CHANGE_FILE_NAME |
+										  FILE_NOTIFY_CHANGE_DIR_NAME |
+										  FILE_NOTIFY_CHANGE_LAST_WRITE, &bytes, NULL, NULL))
+	{
+		const char* pos = reinterpret_cast<const char*>(buf.data());
+		while (bytes > 0 && !stop)
+		{
+			const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(pos);
+
+			int wlen = static_cast<int>(info->FileNameLength / sizeof(WCHAR));
+			int len = WideCharToMultiByte(CP_ACP, 0, info->FileName, wlen, NULL, 0, NULL, NULL);
+			std::string rel(len, '\0');
+			WideCharToMultiByte(CP_ACP, 0, info->FileName, wlen, &rel[0], len, NULL, NULL);
+			std::string name = dirname + "\\" + rel;	//!< File the event is about
+
+			DWORD attrs = GetFileAttributesA(name.c_str());
+			bool isdir = attrs != INVALID_FILE_ATTRIBUTES && (attrs & FILE_ATTRIBUTE_DIRECTORY);
+
+			switch (info->Action)
+			{
+				case FILE_ACTION_ADDED:
+				case FILE_ACTION_RENAMED_NEW_NAME:
+					if (isdir)
+						report_tree(name);
+					else
+						added(name);
+					break;
+				case FILE_ACTION_MODIFIED:
+					if (!isdir)
+						added(name);
+					break;
+				case FILE_ACTION_REMOVED:
+				case FILE_ACTION_RENAMED_OLD_NAME:
+					removed(name);
+					break;
+			}
+
+			if (info->NextEntryOffset == 0)
+				break;
+			pos += info->NextEntryOffset;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef __APPLE__
+#include <CoreServices/CoreServices.h>
+#endif
+
+/******************************************************************************
+ * \brief Watch of a directory tree for files added, changed, and removed
+ *
+ * The watch reports files written, moved in, or changed with added, and
+ * files and directories deleted or moved out with removed.  Files in a
+ * directory created or moved in are reported with added one by one.  A file
+ * may be reported more than once while it is being written.  Events are
+ * picked up by inotify in Linux, FSEvents in Apple, and
+ * ReadDirectoryChangesW in Windows, and the functions are called from a
+ * thread of the watch.  Events lost when the system queue overflows are not
+ * recovered.
+ *
+ * inotify watches one directory at a time, so in Linux the directories of the
+ * tree are not walked on their own, which would read the whole tree once
+ * more: they must be handed to watch_dir() as the scan comes to them, before
+ * it reads them.  Directories created later are watched as they appear.  In
+ * Apple and Windows, the whole tree is watched at once and watch_dir() does
+ * nothing.
+ *****************************************************************************/
+
+class DirWatcher
+{
+public:
+	typedef std::function<void(const std::string&)> Callback;
+
+	DirWatcher(const std::string& dirname, const Callback& added, const Callback& removed);
+	~DirWatcher();
+
+	DirWatcher(const DirWatcher&) = delete;
+	DirWatcher& operator=(const DirWatcher&) = delete;
+
+	void watch_dir(const std::string& dir);
+
+private:
+	void report_tree(const std::string& dir);
+
+	std::string dirname;			//!< Top directory of the tree
+	Callback added;					//!< Function called with each file added or changed
+	Callback removed;				//!< Function called with each file or directory removed
+
+#if defined(__linux__)
+	void watch_tree(const std::string& dir, bool report);
+	void forget_tree(const std::string& dir);
+	void run();
+
+	int fd = -1;					//!< inotify instance
+	int wake[2] = { -1, -1 };		//!< Pipe written to stop the thread
+	std::unordered_map<int, std::string> dirs;	//!< Directories watched, by watch descriptor
+	std::mutex lock;				//!< Protects dirs
+	std::thread thread;				//!< Thread reading the events
+#elif defined(__APPLE__)
+	static void events(ConstFSEventStreamRef stream, void* info, size_t n, void* paths,
+					   const FSEventStreamEventFlags flags[], const FSEventStreamEventId ids[]);
+
+	std::string real;				//!< Absolute name of the top directory
+	FSEventStreamRef stream = nullptr;	//!< Stream of events under the top directory
+	dispatch_queue_t queue = nullptr;	//!< Queue the events are delivered on
+#elif defined(_WIN32)
+	void run();
+
+	void* dir = nullptr;			//!< Handle of the top directory
+	std::atomic<bool> stop;			//!< Set to stop the thread
+	std::thread thread;				//!< Thread reading the events
+#endif
+};
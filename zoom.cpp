@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <map>
+#include <string>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include "governor.hpp"
+#include "mapfile.hpp"
+#include "stats.hpp"
+#include "zoom.hpp"
+
+static const double max_scale = 4;		//!< Most an original pixel may be enlarged
+static const int max_level = 16;		//!< Coarsest level of the pyramid
+
+/******************************************************************************
+ * \brief Set up a view of the whole image fitted to the window
+ *
+ * Nothing is decoded until the view is zoomed in.  The view enrolls with the
+ * memory governor, last in rank since it cannot shed.
+ *
+ * @param [in] path name of the image file
+ * @param [in] cols number of columns in the original image, as displayed
+ * @param [in] rows number of rows in the original image, as displayed
+ * @param [in] maxrows maximum number of rows in display window
+ * @param [in] maxcols maximum number of columns in display window
+ * @param [in] budget maximum number of bytes in levels kept
+ *****************************************************************************/
+
+ZoomView::ZoomView(const std::string& path, int cols, int rows, int maxrows, int maxcols,
+				   size_t budget) :
+	path(path), cols(std::max(cols, 1)), rows(std::max(rows, 1)), maxrows(maxrows),
+	maxcols(maxcols), budget(budget), kept(0)
+{
+	fit = std::min(1.0, std::min(static_cast<double>(maxcols) / this->cols,
+								 static_cast<double>(maxrows) / this->rows));
+	cx = this->cols / 2.0;
+	cy = this->rows / 2.0;
+	MemoryGovernor::enroll(this, 2);
+}
+
+/******************************************************************************
+ * \brief Drop the view and its levels
+ *****************************************************************************/
+
+ZoomView::~ZoomView()
+{
+	MemoryGovernor::leave(this);
+}
+
+/******************************************************************************
+ * \brief Find the most bytes the levels may take
+ *
+ * That is the budget of the view, or less if the memory governor has less
+ * room for it.
+ *
+ * \return number of bytes
+ *****************************************************************************/
+
+size_t ZoomView::limit() const
+{
+	return (std::min(budget, MemoryGovernor::room(this)));
+}
+
+/******************************************************************************
+ * \brief Double the magnification
+ *
+ * \return true if the magnification changed, false if it is at its maximum
+ *****************************************************************************/
+
+bool ZoomView::zoom_in()
+{
+	if (fit * zoom * 2 > max_scale)
+		return (false);
+	zoom *= 2;
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Halve the magnification, down to the fitted image
+ *
+ * \return true if the magnification changed, false if it is at its minimum
+ *****************************************************************************/
+
+bool ZoomView::zoom_out()
+{
+	if (zoom <= 1)
+		return (false);
+	zoom = std::max(zoom / 2, 1.0);
+	clamp();
+	return (true);
+}
+
+/******************************************************************************
+ * \brief Move the view by a quarter of its size
+ *
+ * @param [in] dx number of quarters to move right, negative to move left
+ * @param [in] dy number of quarters to move down, negative to move up
+ *****************************************************************************/
+
+void ZoomView::pan(int dx, int dy)
+{
+	double s = fit * zoom;				//!< Scale of the original in the view
+	cx += dx * maxcols / (4 * s);
+	cy += dy * maxrows / (4 * s);
+	clamp();
+}
+
+/******************************************************************************
+ * \brief Keep the view inside the image
+ *****************************************************************************/
+
+void ZoomView::clamp()
+{
+	double s = fit * zoom;				//!< Scale of the original in the view
+	double hw = std::min(static_cast<double>(cols), maxcols / s) / 2;	//!< Half the view width
+	double hh = std::min(static_cast<double>(rows), maxrows / s) / 2;	//!< Half the view height
+
+	cx = std::min(std::max(cx, hw), cols - hw);
+	cy = std::min(std::max(cy, hh), rows - hh);
+}
+
+/******************************************************************************
+ * \brief Find the number of bytes in a level
+ *
+ * @param [in] l level of the pyramid
+ * \return number of bytes of the level in BGR
+ *****************************************************************************/
+
+size_t ZoomView::level_bytes(int l) const
+{
+	size_t lcols = (static_cast<size_t>(cols) + (size_t(1) << l) - 1) >> l;
+	size_t lrows = (static_cast<size_t>(rows) + (size_t(1) << l) - 1) >> l;
+	return (lcols * lrows * 3);
+}
+
+/******************************************************************************
+ * \brief Get a level of the pyramid
+ *
+ * Reduce the finest level already decoded that is finer than the one asked
+ * for, or decode the file at the coarsest resolution the codec can give that
+ * is still as fine, unless the image decoded would not fit in the limit: the
+ * full image for files other than JPEG, and level 3 at the coarsest for JPEG
+ * files.  Then drop the levels finer than the one asked for while
+ * the levels kept are over the limit, and let the memory governor make room
+ * for the rest.
+ *
+ * @param [in] l level of the pyramid
+ * \return the level, or an empty image if the file cannot be decoded or
+ *         would not fit
+ *****************************************************************************/
+
+cv::Mat ZoomView::level(int l)
+{
+	auto found = levels.find(l);
+	if (found != levels.end())
+		return (found->second);
+
+	cv::Mat img;						//!< Level to be returned
+	cv::Size size(static_cast<int>((cols + (1 << l) - 1) >> l),
+				  static_cast<int>((rows + (1 << l) - 1) >> l));	//!< Size of the level
+
+	auto finer = levels.lower_bound(l);	//!< First level coarser than l
+	if (finer != levels.begin())
+	{
+		--finer;
+		StageTimer timer(Stage::scale, path);
+		cv::resize(finer->second, img, size, 0, 0, cv::INTER_AREA);
+	}
+	else
+	{
+		static const int modes[] = { cv::IMREAD_COLOR, cv::IMREAD_REDUCED_COLOR_2,
+									 cv::IMREAD_REDUCED_COLOR_4, cv::IMREAD_REDUCED_COLOR_8 };
+		MappedFile file(path);
+		bool jpeg = file.size() >= 2 && file.data()[0] == 0xFF && file.data()[1] == 0xD8;
+		int decoded = jpeg ? std::min(l, 3) : 0;	//!< Level the codec decodes to
+		if (level_bytes(decoded) > limit())
+			return (img);
+
+		StageTimer timer(Stage::decode, path);
+		int mode = modes[decoded];		//!< Flags for cv::imdecode
+
+		if (!file.data() || file.size() > static_cast<size_t>(INT_MAX))
+		{
+			img = cv::imread(path, mode);
+		}
+		else
+		{
+			cv::Mat bytes(1, static_cast<int>(file.size()), CV_8UC1,
+						  const_cast<unsigned char*>(file.data()));	//!< Contents of the file
+			img = cv::imdecode(bytes, mode);
+		}
+		if (img.empty())
+			return (img);
+		if (img.size() != size)
+			cv::resize(img, img, size, 0, 0, cv::INTER_AREA);
+	}
+	levels[l] = img;
+
+	size_t bytes = 0;					//!< Number of bytes in levels kept
+	for (const auto& e : levels)
+		bytes += e.second.total() * e.second.elemSize();
+	size_t most = limit();				//!< Most bytes the levels may take
+	for (auto e = levels.begin(); bytes > most && e->first < l; )
+	{
+		bytes -= e->second.total() * e->second.elemSize();
+		e = levels.erase(e);
+	}
+	kept = bytes;
+	MemoryGovernor::balance();
+
+	return (img);
+}
+
+/******************************************************************************
+ * \brief Render the view
+ *
+ * Take the coarsest level that still has as many pixels as the view shows,
+ * or the finest one that fits in the limit, cut out the part in view, and
+ * scale it to the window.
+ *
+ * \return the view, no bigger than the window, or an empty image if the file
+ *         cannot be decoded
+ *****************************************************************************/
+
+cv::Mat ZoomView::render()
+{
+	double s = fit * zoom;				//!< Scale of the original in the view
+
+	int l = 0;							//!< Level to cut the view from
+	while (l < max_level && std::ldexp(1.0, -(l + 1)) >= s)
+		l++;
+	size_t most = limit();				//!< Most bytes the level may take
+	while (l < max_level && level_bytes(l) > most)
+		l++;
+
+	cv::Mat src = level(l);				//!< Level to cut the view from
+	if (src.empty())
+		return (src);
+
+	clamp();
+	double f = std::ldexp(1.0, -l);		//!< Scale of the level
+	double vw = std::min(static_cast<double>(cols), maxcols / s);	//!< Width of the view
+	double vh = std::min(static_cast<double>(rows), maxrows / s);	//!< Height of the view
+	cv::Rect roi(static_cast<int>(std::floor((cx - vw / 2) * f)),
+				 static_cast<int>(std::floor((cy - vh / 2) * f)),
+				 static_cast<int>(std::ceil(vw * f)), static_cast<int>(std::ceil(vh * f)));
+	roi &= cv::Rect(0, 0, src.cols, src.rows);
+	if (roi.area() == 0)
+		return (cv::Mat());
+
+	cv::Size out(std::min(maxcols, std::max(1, static_cast<int>(std::lround(roi.width * s / f)))),
+				 std::min(maxrows, std::max(1, static_cast<int>(std::lround(roi.height * s / f)))));
+	cv::Mat view;						//!< View to be returned
+	StageTimer timer(Stage::scale, path);
+	cv::resize(src(roi), view, out, 0, 0, s < f ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+	return (view);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+
+/******************************************************************************
+ * \brief Zoomed view of a part of one image
+ *
+ * Scaling a whole image to fit the window throws away most of the pixels of
+ * a panorama or a scanned map.  The view shows the part of the image around
+ * a centre at a magnification relative to the fitted image, and decodes the
+ * image only at the resolution that magnification needs, as a level of a
+ * pyramid where level l has 1/2^l of the resolution of the original.  JPEG
+ * files are decoded straight to levels up to 3 with the scaled decode of the
+ * codec; coarser levels are reduced from the finest level already decoded.
+ * Levels are kept for panning and zooming back and forth up to a budget in
+ * bytes, and a level that would not fit in the budget is not made; the next
+ * coarser level is enlarged instead.  Other files can only be decoded in
+ * full, so they are not zoomed at all when the whole image would not fit in
+ * the budget, and neither are JPEG files too big for it even at level 3.  The levels count towards the
+ * budget of the memory governor but are not shed by it; rather, the view
+ * keeps to the room the governor has left when it decodes.
+ *****************************************************************************/
+
+class ZoomView : public MemoryGovernor::Consumer
+{
+public:
+	ZoomView(const std::string& path, int cols, int rows, int maxrows, int maxcols,
+			 size_t budget);
+	~ZoomView();
+
+	ZoomView(const ZoomView&) = delete;
+	ZoomView& operator=(const ZoomView&) = delete;
+
+	bool zoom_in();
+	bool zoom_out();
+	void pan(int dx, int dy);
+	bool zoomed() const { return (zoom > 1); }
+	cv::Mat render();
+
+	size_t held() const override { return (kept); }
+	size_t shed(size_t /*bytes*/) override { return (0); }
+
+private:
+	cv::Mat level(int l);
+	size_t limit() const;
+	size_t level_bytes(int l) const;
+	void clamp();
+
+	std::string path;			//!< Name of the image file
+	int cols;					//!< Number of columns in the original image
+	int rows;					//!< Number of rows in the original image
+	int maxrows;				//!< Maximum number of rows in display window
+	int maxcols;				//!< Maximum number of columns in display window
+	size_t budget;				//!< Maximum number of bytes in levels kept
+	double fit;					//!< Scale of the image fitted to the window
+	double zoom = 1;			//!< Magnification relative to the fitted image
+	double cx;					//!< Column of the original at the centre of the view
+	double cy;					//!< Row of the original at the centre of the view
+	std::map<int, cv::Mat> levels;	//!< Levels decoded so far, finest first
+	std::atomic<size_t> kept;	//!< Number of bytes in levels
+};